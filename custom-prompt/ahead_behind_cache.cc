@@ -0,0 +1,104 @@
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "ahead_behind_cache.hh"
+#include "disk_cache.hh"
+#include "json_logger.hh"
+
+static JSONLogger logger;
+
+static char const AHEAD_BEHIND_CACHE_MAGIC[] = "custom-prompt-ahead-behind 1";
+
+// Number of pairs of commits remembered per repository. Only the most recent
+// ones are likely to be needed again.
+static std::size_t constexpr AHEAD_BEHIND_CACHE_ENTRIES = 64;
+
+/**
+ * Prepare to cache the numbers of commits by which two commits of the given
+ * Git repository differ.
+ *
+ * @param repo Git repository.
+ * @param local_oid Object ID of the local commit.
+ * @param upstream_oid Object ID of the upstream commit.
+ */
+AheadBehindCache::AheadBehindCache(
+    C::git_repository* repo, C::git_oid const* local_oid, C::git_oid const* upstream_oid
+) :
+    path(cache_file_path("ahead-behind", C::git_repository_commondir(repo)))
+{
+    this->key = C::git_oid_tostr_s(local_oid);
+    this->key += ' ';
+    this->key += C::git_oid_tostr_s(upstream_oid);
+}
+
+/**
+ * Read the cached numbers.
+ *
+ * @param ahead Number of commits reachable only from the local commit.
+ * @param behind Number of commits reachable only from the upstream commit.
+ *
+ * @return Whether the numbers were found. If not, the arguments are not
+ * modified.
+ */
+bool AheadBehindCache::load(std::size_t& ahead, std::size_t& behind) const
+{
+    if (this->path.empty())
+    {
+        return false;
+    }
+    std::ifstream cache_file(this->path);
+    std::string line;
+    if (!std::getline(cache_file, line) || line != AHEAD_BEHIND_CACHE_MAGIC)
+    {
+        return false;
+    }
+    while (std::getline(cache_file, line))
+    {
+        if (line.compare(0, this->key.size(), this->key) != 0 || line.size() <= this->key.size()
+            || line[this->key.size()] != ' ')
+        {
+            continue;
+        }
+        std::istringstream line_stream(line.substr(this->key.size()));
+        if (line_stream >> ahead >> behind)
+        {
+            LOG_DEBUG(logger, "Using cached ahead/behind", "ahead", ahead, "behind", behind);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Cache the given numbers. The least recently stored numbers are forgotten if
+ * there are too many.
+ *
+ * @param ahead Number of commits reachable only from the local commit.
+ * @param behind Number of commits reachable only from the upstream commit.
+ */
+void AheadBehindCache::store(std::size_t ahead, std::size_t behind) const
+{
+    if (this->path.empty())
+    {
+        return;
+    }
+    std::ostringstream cache_stream;
+    cache_stream << AHEAD_BEHIND_CACHE_MAGIC << '\n' << this->key << ' ' << ahead << ' ' << behind << '\n';
+    std::ifstream cache_file(this->path);
+    std::string line;
+    if (std::getline(cache_file, line) && line == AHEAD_BEHIND_CACHE_MAGIC)
+    {
+        for (std::size_t entries = 1; entries < AHEAD_BEHIND_CACHE_ENTRIES && std::getline(cache_file, line);)
+        {
+            if (line.compare(0, this->key.size(), this->key) != 0)
+            {
+                cache_stream << line << '\n';
+                ++entries;
+            }
+        }
+    }
+    replace_file_contents(this->path, cache_stream.str());
+}
@@ -0,0 +1,27 @@
+#ifndef AHEAD_BEHIND_CACHE_HH_
+#define AHEAD_BEHIND_CACHE_HH_
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+#include "libgit2.hh"
+
+/**
+ * Remember the numbers of commits by which pairs of commits of a Git
+ * repository differ. Since commits are immutable, these numbers never become
+ * outdated.
+ */
+class AheadBehindCache
+{
+private:
+    std::filesystem::path path;
+    std::string key;
+
+public:
+    AheadBehindCache(C::git_repository*, C::git_oid const*, C::git_oid const*);
+    bool load(std::size_t&, std::size_t&) const;
+    void store(std::size_t, std::size_t) const;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#! /usr/bin/env bash
+
+# Generate a Git repository of the requested shape in a temporary directory,
+# and run the benchmark executable in it.
+
+usage()
+{
+    cat <<EOF
+Usage: $0 [OPTIONS] BENCHMARK_EXECUTABLE
+
+Options:
+    -f FILES        number of tracked files (default 10000)
+    -d PERCENTAGE   percentage of tracked files which are modified (default 5)
+    -u FILES        number of untracked files (default 10)
+    -t TAGS         number of tags, half of them annotated (default 100)
+    -c COMMITS      number of commits in the history (default 1000)
+    -v COMMITS      number of commits on each side of the upstream branch (default 10)
+    -D              detach HEAD at the newest tagged commit
+    -g              write a commit-graph
+    -m              use fsmonitor-stand-in.bash as the file system monitor
+    -U              enable the untracked cache
+    -i              obtain stat data through io_uring
+    -C              drop the page cache first, so that the first run is cold (Linux only; needs root)
+    -n RUNS         number of times each stage is run (default 1000)
+EOF
+    exit 1
+}
+
+files=10000
+dirty_percentage=5
+untracked_files=10
+tags=100
+commits=1000
+divergence=10
+detach=0
+commit_graph=0
+fsmonitor=0
+untracked_cache=0
+io_uring=0
+cold=0
+runs=1000
+while getopts "f:d:u:t:c:v:DgmUiCn:" option
+do
+    case $option in
+        (f) files=$OPTARG;;
+        (d) dirty_percentage=$OPTARG;;
+        (u) untracked_files=$OPTARG;;
+        (t) tags=$OPTARG;;
+        (c) commits=$OPTARG;;
+        (v) divergence=$OPTARG;;
+        (D) detach=1;;
+        (g) commit_graph=1;;
+        (m) fsmonitor=1;;
+        (U) untracked_cache=1;;
+        (i) io_uring=1;;
+        (C) cold=1;;
+        (n) runs=$OPTARG;;
+        (*) usage;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] && [ $commits -ge 1 ] || usage
+executable=$(realpath "$1")
+fsmonitor_hook=$(dirname "$(realpath "$0")")/fsmonitor-stand-in.bash
+
+directory=$(mktemp -d)
+trap "rm -rf $directory" EXIT
+git init --quiet --initial-branch=main $directory/repository || exit 1
+cd $directory/repository
+
+# Write the entire history as a fast-import stream: the first commit adds all
+# files, each subsequent one modifies a single file. The last few commits on
+# the local and upstream branches diverge.
+awk -v files=$files -v tags=$tags -v commits=$commits -v divergence=$divergence '
+function commit(ref, mark, parent, path)
+{
+    printf "commit %s\nmark :%d\ncommitter Benchmark <benchmark@localhost> %d +0000\n", ref, mark, 1e9 + mark
+    printf "data <<END\nCommit %d\nEND\n", mark
+    if (parent > 0)
+    {
+        printf "from :%d\n", parent
+    }
+    printf "M 644 inline %s\ndata <<END\n%d\nEND\n\n", path, mark
+}
+BEGIN {
+    printf "commit refs/heads/main\nmark :1\ncommitter Benchmark <benchmark@localhost> 1000000000 +0000\n"
+    printf "data <<END\nCommit 1\nEND\n"
+    for (i = 0; i < files; ++i)
+    {
+        printf "M 644 inline directory%d/file%d\ndata <<END\n%d\nEND\n", i / 100, i, i
+    }
+    printf "\n"
+    for (mark = 2; mark <= commits; ++mark)
+    {
+        commit("refs/heads/main", mark, mark - 1, "history")
+    }
+    for (i = 1; i <= divergence; ++i)
+    {
+        commit("refs/heads/main", commits + i, i == 1 ? commits : commits + i - 1, "local")
+        commit("refs/remotes/origin/main", commits + divergence + i, i == 1 ? commits : commits + divergence + i - 1,
+            "upstream")
+    }
+    if (divergence == 0)
+    {
+        printf "reset refs/remotes/origin/main\nfrom :%d\n\n", commits
+    }
+    for (i = 1; i <= tags; ++i)
+    {
+        mark = int((i - 1) * commits / tags) + 1
+        if (i % 2 == 0)
+        {
+            printf "tag tag%d\nfrom :%d\ntagger Benchmark <benchmark@localhost> 1000000000 +0000\n", i, mark
+            printf "data <<END\nTag %d\nEND\n\n", i
+        }
+        else
+        {
+            printf "reset refs/tags/tag%d\nfrom :%d\n\n", i, mark
+        }
+    }
+}
+' | git fast-import --quiet || exit 1
+git remote add origin /dev/null
+git config branch.main.remote origin
+git config branch.main.merge refs/heads/main
+git pack-refs --all
+((tags > 0 && detach)) && git checkout --quiet --detach tag$tags^{commit}
+git reset --quiet --hard
+((commit_graph)) && git commit-graph write --reachable
+if ((fsmonitor))
+then
+    git config core.fsmonitor $fsmonitor_hook
+    git config core.fsmonitorHookVersion 2
+fi
+((untracked_cache)) && git config core.untrackedCache true
+
+git ls-files -z | awk -v RS='\0' -v ORS='\0' -v percentage=$dirty_percentage \
+    'int(NR * percentage / 100) != int((NR - 1) * percentage / 100)' \
+    | xargs -0 -r sh -c 'for file; do echo >>"$file"; done' sh
+for ((i = 0; i < untracked_files; ++i))
+do
+    echo $i >untracked$i
+done
+
+((io_uring)) && export CUSTOM_PROMPT_IO_URING=1
+if ((cold))
+then
+    sync
+    echo 3 >/proc/sys/vm/drop_caches || exit 1
+fi
+
+# Keep the caches away from the real ones.
+XDG_CACHE_HOME=$directory/cache $executable $runs
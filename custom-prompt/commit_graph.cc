@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "commit_graph.hh"
+#include "json_logger.hh"
+
+static JSONLogger logger;
+
+// Chunk IDs.
+static std::uint32_t constexpr CHUNK_OID_FANOUT = 0x4F494446;
+static std::uint32_t constexpr CHUNK_OID_LOOKUP = 0x4F49444C;
+static std::uint32_t constexpr CHUNK_COMMIT_DATA = 0x43444154;
+static std::uint32_t constexpr CHUNK_EXTRA_EDGES = 0x45444745;
+
+// Only SHA-1 graphs are read, since that is what libgit2 uses by default.
+static std::size_t constexpr OID_SIZE = 20;
+// Root tree ID, two parent positions, generation number and commit time.
+static std::size_t constexpr COMMIT_DATA_SIZE = OID_SIZE + 16;
+static std::uint32_t constexpr PARENT_NONE = 0x70000000;
+static std::uint32_t constexpr PARENT_EXTRA_EDGES = 0x80000000;
+
+// Commits not in the graph must be read from the object database. If there
+// are too many, walking history with libgit2 is just as good.
+static std::size_t constexpr EXTRA_COMMITS_MAX = 4096;
+
+// Flags marking which tips a commit is reachable from.
+static unsigned char constexpr REACHABLE_FROM_LOCAL = 1;
+static unsigned char constexpr REACHABLE_FROM_UPSTREAM = 2;
+static unsigned char constexpr REACHABLE_FROM_BOTH = REACHABLE_FROM_LOCAL | REACHABLE_FROM_UPSTREAM;
+
+/**
+ * Read a big-endian 32-bit integer.
+ *
+ * @param ptr Location of the integer.
+ *
+ * @return Integer.
+ */
+static std::uint32_t read_be32(unsigned char const* ptr)
+{
+    return std::uint32_t(ptr[0]) << 24 | std::uint32_t(ptr[1]) << 16 | std::uint32_t(ptr[2]) << 8 | ptr[3];
+}
+
+/**
+ * Read a big-endian 64-bit integer.
+ *
+ * @param ptr Location of the integer.
+ *
+ * @return Integer.
+ */
+static std::uint64_t read_be64(unsigned char const* ptr)
+{
+    return std::uint64_t(read_be32(ptr)) << 32 | read_be32(ptr + 4);
+}
+
+/**
+ * Load the commit-graph of a Git repository. If there is a single
+ * commit-graph file, it is used; otherwise, the split commit-graph files are
+ * used. If neither is usable, the graph is empty.
+ *
+ * @param objects_directory Object directory of the repository.
+ */
+CommitGraph::CommitGraph(std::filesystem::path const& objects_directory)
+{
+    std::filesystem::path info_directory = objects_directory / "info";
+    if (this->add_layer(info_directory / "commit-graph"))
+    {
+        return;
+    }
+    std::ifstream chain_file(info_directory / "commit-graphs/commit-graph-chain");
+    std::string hash;
+    while (chain_file >> hash)
+    {
+        if (!this->add_layer(info_directory / "commit-graphs" / ("graph-" + hash + ".graph")))
+        {
+            // A graph with a missing layer is useless.
+            this->clear();
+            return;
+        }
+    }
+}
+
+/**
+ * Unload the commit-graph.
+ */
+CommitGraph::~CommitGraph()
+{
+    this->clear();
+}
+
+/**
+ * Unmap all commit-graph files.
+ */
+void CommitGraph::clear(void)
+{
+#ifndef _WIN32
+    for (Layer const& layer : this->layers)
+    {
+        munmap(const_cast<unsigned char*>(layer.data), layer.size);
+    }
+#endif
+    this->layers.clear();
+}
+
+/**
+ * Map a commit-graph file into memory and locate its chunks.
+ *
+ * @param path File path.
+ *
+ * @return Whether the file is a usable commit-graph file.
+ */
+bool CommitGraph::add_layer(std::filesystem::path const& path)
+{
+#ifdef _WIN32
+    return false;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 8)
+    {
+        close(fd);
+        return false;
+    }
+    std::size_t size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    Layer layer = {};
+    layer.data = static_cast<unsigned char const*>(mapping);
+    layer.size = size;
+    layer.offset = this->layers.empty() ? 0 : this->layers.back().offset + this->layers.back().count;
+    // Signature, version, hash version (1 means SHA-1), number of chunks and
+    // number of base graphs.
+    bool valid = std::memcmp(layer.data, "CGPH", 4) == 0 && layer.data[4] == 1 && layer.data[5] == 1;
+    std::size_t chunk_count = layer.data[6];
+    valid = valid && 8 + (chunk_count + 1) * 12 <= size;
+    std::size_t extra_edges_size = 0, oids_size = 0, commit_data_size = 0;
+    for (std::size_t i = 0; valid && i < chunk_count; ++i)
+    {
+        unsigned char const* entry = layer.data + 8 + i * 12;
+        std::uint64_t begin = read_be64(entry + 4);
+        std::uint64_t end = read_be64(entry + 16);
+        if (begin > end || end > size)
+        {
+            valid = false;
+            break;
+        }
+        switch (read_be32(entry))
+        {
+        case CHUNK_OID_FANOUT:
+            layer.fanout = layer.data + begin;
+            valid = end - begin == 256 * 4;
+            break;
+        case CHUNK_OID_LOOKUP:
+            layer.oids = layer.data + begin;
+            oids_size = end - begin;
+            break;
+        case CHUNK_COMMIT_DATA:
+            layer.commit_data = layer.data + begin;
+            commit_data_size = end - begin;
+            break;
+        case CHUNK_EXTRA_EDGES:
+            layer.extra_edges = layer.data + begin;
+            extra_edges_size = end - begin;
+            break;
+        }
+    }
+    if (valid && layer.fanout != nullptr && layer.oids != nullptr && layer.commit_data != nullptr)
+    {
+        layer.count = read_be32(layer.fanout + 255 * 4);
+        layer.extra_edges_count = extra_edges_size / 4;
+        // Old graphs may lack generation numbers, which makes them useless
+        // for this purpose.
+        valid = oids_size >= layer.count * OID_SIZE && commit_data_size >= layer.count * COMMIT_DATA_SIZE
+            && (layer.count == 0 || read_be32(layer.commit_data + OID_SIZE + 8) >> 2 != 0);
+    }
+    else
+    {
+        valid = false;
+    }
+    if (!valid)
+    {
+        munmap(mapping, size);
+        return false;
+    }
+    this->layers.push_back(layer);
+    LOG_DEBUG(logger, "Loaded commit-graph file", "path", path.string(), "commits", layer.count);
+    return true;
+#endif
+}
+
+/**
+ * Find the position of a commit in the graph.
+ *
+ * @param oid Object ID of the commit.
+ * @param position Position of the commit.
+ *
+ * @return Whether the commit is in the graph.
+ */
+bool CommitGraph::find(unsigned char const* oid, std::uint64_t& position) const
+{
+    for (Layer const& layer : this->layers)
+    {
+        std::uint32_t low = oid[0] == 0 ? 0 : read_be32(layer.fanout + (oid[0] - 1) * 4);
+        std::uint32_t high = std::min(read_be32(layer.fanout + oid[0] * 4), layer.count);
+        while (low < high)
+        {
+            std::uint32_t mid = low + (high - low) / 2;
+            int comparison = std::memcmp(layer.oids + mid * OID_SIZE, oid, OID_SIZE);
+            if (comparison == 0)
+            {
+                position = layer.offset + mid;
+                return true;
+            }
+            if (comparison < 0)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Find the position of a commit, adding it (and any of its ancestors which are
+ * not in the graph) to the graph if required.
+ *
+ * @param repo Git repository.
+ * @param oid Object ID of the commit.
+ * @param position Position of the commit.
+ *
+ * @return Whether the commit was found.
+ */
+bool CommitGraph::resolve(C::git_repository* repo, C::git_oid const* oid, std::uint64_t& position)
+{
+    std::uint64_t graph_size = this->layers.empty() ? 0 : this->layers.back().offset + this->layers.back().count;
+    auto find_any = [this](C::git_oid const& commit_oid, std::uint64_t& commit_position)
+    {
+        if (this->find(commit_oid.id, commit_position))
+        {
+            return true;
+        }
+        auto it = this->extra_positions.find(std::string(reinterpret_cast<char const*>(commit_oid.id), OID_SIZE));
+        if (it == this->extra_positions.end())
+        {
+            return false;
+        }
+        commit_position = it->second;
+        return true;
+    };
+
+    // Commits created after the graph was written are usually few. Read them
+    // from the object database, parents first, so that their generation
+    // numbers can be computed.
+    std::vector<C::git_oid> pending = { *oid };
+    std::map<std::string, std::vector<C::git_oid>> pending_parents;
+    while (!pending.empty())
+    {
+        C::git_oid pending_oid = pending.back();
+        std::uint64_t pending_position;
+        if (find_any(pending_oid, pending_position))
+        {
+            pending.pop_back();
+            continue;
+        }
+        std::string key(reinterpret_cast<char const*>(pending_oid.id), OID_SIZE);
+        auto it = pending_parents.find(key);
+        if (it == pending_parents.end())
+        {
+            C::git_commit* commit;
+            if (this->extra_commits.size() + pending_parents.size() >= EXTRA_COMMITS_MAX
+                || C::git_commit_lookup(&commit, repo, &pending_oid) != 0)
+            {
+                return false;
+            }
+            std::vector<C::git_oid> parents;
+            for (unsigned i = 0, parentcount = C::git_commit_parentcount(commit); i < parentcount; ++i)
+            {
+                parents.push_back(*C::git_commit_parent_id(commit, i));
+            }
+            C::git_commit_free(commit);
+            pending.insert(pending.end(), parents.begin(), parents.end());
+            pending_parents.emplace(std::move(key), std::move(parents));
+            continue;
+        }
+
+        // All parents have been found by now.
+        ExtraCommit extra_commit = { {}, 1 };
+        for (C::git_oid const& parent : it->second)
+        {
+            std::uint64_t parent_position;
+            if (!find_any(parent, parent_position))
+            {
+                return false;
+            }
+            extra_commit.parents.push_back(parent_position);
+            extra_commit.generation = std::max(extra_commit.generation, this->generation(parent_position) + 1);
+        }
+        this->extra_positions.emplace(std::move(key), graph_size + this->extra_commits.size());
+        this->extra_commits.push_back(std::move(extra_commit));
+        pending_parents.erase(it);
+        pending.pop_back();
+    }
+    return find_any(*oid, position);
+}
+
+/**
+ * Obtain the generation number of a commit, which is greater than the
+ * generation numbers of all of its ancestors.
+ *
+ * @param position Position of the commit.
+ *
+ * @return Generation number.
+ */
+std::uint32_t CommitGraph::generation(std::uint64_t position) const
+{
+    for (Layer const& layer : this->layers)
+    {
+        if (position < layer.offset + layer.count)
+        {
+            return read_be32(layer.commit_data + (position - layer.offset) * COMMIT_DATA_SIZE + OID_SIZE + 8) >> 2;
+        }
+    }
+    std::uint64_t graph_size = this->layers.empty() ? 0 : this->layers.back().offset + this->layers.back().count;
+    return this->extra_commits[position - graph_size].generation;
+}
+
+/**
+ * Obtain the parents of a commit.
+ *
+ * @param position Position of the commit.
+ * @param parents Positions of the parents.
+ *
+ * @return Whether the parents were obtained. If not, the graph is corrupt.
+ */
+bool CommitGraph::get_parents(std::uint64_t position, std::vector<std::uint64_t>& parents) const
+{
+    parents.clear();
+    std::uint64_t graph_size = this->layers.empty() ? 0 : this->layers.back().offset + this->layers.back().count;
+    if (position >= graph_size)
+    {
+        parents = this->extra_commits[position - graph_size].parents;
+        return true;
+    }
+    Layer const* layer = &this->layers.front();
+    while (position >= layer->offset + layer->count)
+    {
+        ++layer;
+    }
+    unsigned char const* commit_data = layer->commit_data + (position - layer->offset) * COMMIT_DATA_SIZE;
+    std::uint32_t first_parent = read_be32(commit_data + OID_SIZE);
+    std::uint32_t second_parent = read_be32(commit_data + OID_SIZE + 4);
+    if (first_parent != PARENT_NONE)
+    {
+        parents.push_back(first_parent);
+    }
+    if (second_parent != PARENT_NONE && !(second_parent & PARENT_EXTRA_EDGES))
+    {
+        parents.push_back(second_parent);
+    }
+    else if (second_parent != PARENT_NONE)
+    {
+        // Octopus merge. The remaining parents are listed elsewhere, the last
+        // one being marked.
+        std::uint32_t edge = 0;
+        for (std::uint32_t i = second_parent & ~PARENT_EXTRA_EDGES; !(edge & PARENT_EXTRA_EDGES); ++i)
+        {
+            if (i >= layer->extra_edges_count)
+            {
+                return false;
+            }
+            edge = read_be32(layer->extra_edges + i * 4);
+            parents.push_back(edge & ~PARENT_EXTRA_EDGES);
+        }
+    }
+    for (std::uint64_t parent : parents)
+    {
+        if (parent >= graph_size)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Count the commits reachable from one commit but not the other, and vice
+ * versa. History is walked in decreasing order of generation number, so that
+ * every commit is visited after all of its descendants, and the walk stops as
+ * soon as every commit left to visit is reachable from both. This is what
+ * makes it fast when the two commits are far apart but their merge base is
+ * not far behind either of them.
+ *
+ * @param repo Git repository.
+ * @param local_oid Object ID of the local commit.
+ * @param upstream_oid Object ID of the upstream commit.
+ * @param ahead Number of commits reachable only from the local commit.
+ * @param behind Number of commits reachable only from the upstream commit.
+ *
+ * @return Whether the numbers were obtained. If not, the arguments are not
+ * modified.
+ */
+bool CommitGraph::ahead_behind(
+    C::git_repository* repo, C::git_oid const* local_oid, C::git_oid const* upstream_oid, std::size_t& ahead,
+    std::size_t& behind
+)
+{
+    std::uint64_t local, upstream;
+    if (this->layers.empty() || !this->resolve(repo, local_oid, local) || !this->resolve(repo, upstream_oid, upstream))
+    {
+        return false;
+    }
+
+    std::unordered_map<std::uint64_t, unsigned char> flags;
+    std::priority_queue<std::pair<std::uint32_t, std::uint64_t>> queue;
+    // Number of commits left to visit which are not reachable from both.
+    std::size_t active = 0;
+    auto mark = [&](std::uint64_t position, unsigned char flag)
+    {
+        auto [it, inserted] = flags.emplace(position, 0);
+        unsigned char old_flag = it->second;
+        it->second |= flag;
+        if (inserted)
+        {
+            queue.emplace(this->generation(position), position);
+            active += it->second != REACHABLE_FROM_BOTH;
+        }
+        else if (old_flag != REACHABLE_FROM_BOTH && it->second == REACHABLE_FROM_BOTH)
+        {
+            --active;
+        }
+    };
+    mark(local, REACHABLE_FROM_LOCAL);
+    mark(upstream, REACHABLE_FROM_UPSTREAM);
+
+    std::size_t local_only = 0, upstream_only = 0, visited = 0;
+    std::vector<std::uint64_t> parents;
+    while (active > 0)
+    {
+        std::uint64_t position = queue.top().second;
+        queue.pop();
+        ++visited;
+        unsigned char flag = flags[position];
+        if (flag != REACHABLE_FROM_BOTH)
+        {
+            --active;
+            ++(flag == REACHABLE_FROM_LOCAL ? local_only : upstream_only);
+        }
+        if (!this->get_parents(position, parents))
+        {
+            return false;
+        }
+        for (std::uint64_t parent : parents)
+        {
+            mark(parent, flag);
+        }
+    }
+    LOG_DEBUG(logger, "Walked commit-graph", "visited", visited, "ahead", local_only, "behind", upstream_only);
+    ahead = local_only;
+    behind = upstream_only;
+    return true;
+}
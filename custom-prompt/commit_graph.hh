@@ -0,0 +1,61 @@
+#ifndef COMMIT_GRAPH_HH_
+#define COMMIT_GRAPH_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "libgit2.hh"
+
+/**
+ * Read-only view of the commit-graph file(s) of a Git repository, which store
+ * the parents and generation numbers of commits, so that history can be walked
+ * without reading commit objects.
+ */
+class CommitGraph
+{
+private:
+    /**
+     * One commit-graph file. If the graph is split, each file is a layer, and
+     * commit positions are counted across all layers, base first.
+     */
+    struct Layer
+    {
+        unsigned char const* data;
+        std::size_t size;
+        std::uint32_t offset, count, extra_edges_count;
+        unsigned char const *fanout, *oids, *commit_data, *extra_edges;
+    };
+
+    /**
+     * Commit not in the graph, because it was created after the graph was
+     * written.
+     */
+    struct ExtraCommit
+    {
+        std::vector<std::uint64_t> parents;
+        std::uint32_t generation;
+    };
+
+    std::vector<Layer> layers;
+    std::map<std::string, std::uint64_t> extra_positions;
+    std::vector<ExtraCommit> extra_commits;
+
+public:
+    CommitGraph(std::filesystem::path const&);
+    ~CommitGraph();
+    bool ahead_behind(C::git_repository*, C::git_oid const*, C::git_oid const*, std::size_t&, std::size_t&);
+
+private:
+    void clear(void);
+    bool add_layer(std::filesystem::path const&);
+    bool find(unsigned char const*, std::uint64_t&) const;
+    bool resolve(C::git_repository*, C::git_oid const*, std::uint64_t&);
+    std::uint32_t generation(std::uint64_t) const;
+    bool get_parents(std::uint64_t, std::vector<std::uint64_t>&) const;
+};
+
+#endif
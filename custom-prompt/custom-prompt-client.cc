@@ -0,0 +1,89 @@
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "prompt_socket.hh"
+
+#if defined BASH
+#define SERVER_NAME "custom-bash-prompt"
+#elif defined ZSH
+#define SERVER_NAME "custom-zsh-prompt"
+#else
+#error "unknown shell"
+#endif
+
+extern char** environ;
+
+/**
+ * Start the server in the background, completely detached from the shell.
+ */
+void spawn_server(void)
+{
+    if (fork() != 0)
+    {
+        return;
+    }
+    setsid();
+    if (fork() != 0)
+    {
+        std::_Exit(EXIT_SUCCESS);
+    }
+    int null_fd = open("/dev/null", O_RDWR);
+    for (int fd = 0; fd < 3; ++fd)
+    {
+        dup2(null_fd, fd);
+    }
+    char const* argv[] = { SERVER_NAME, "--server", nullptr };
+    execvp(argv[0], const_cast<char* const*>(argv));
+    std::_Exit(EXIT_FAILURE);
+}
+
+/**
+ * Forward the command line arguments to the prompt server, which does all the
+ * actual work. If the server isn't running, start it for the benefit of the
+ * next prompt, and run the program directly for this prompt.
+ *
+ * @param argc Number of command line arguments.
+ * @param argv Command line arguments.
+ *
+ * @return Exit code.
+ */
+int main(int const argc, char const* argv[])
+{
+    std::signal(SIGINT, SIG_IGN);
+
+    std::string socket_path = prompt_socket_path(SERVER_NAME);
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock >= 0 && socket_path.size() < sizeof address.sun_path)
+    {
+        std::strcpy(address.sun_path, socket_path.data());
+        if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof address) == 0)
+        {
+            if (!send_prompt_request(sock, argc, argv, environ))
+            {
+                return EXIT_FAILURE;
+            }
+            // Wait for the server to finish writing the prompt before letting
+            // the shell continue.
+            char exit_code_byte;
+            if (read(sock, &exit_code_byte, 1) != 1)
+            {
+                return EXIT_FAILURE;
+            }
+            return exit_code_byte;
+        }
+        spawn_server();
+    }
+
+    argv[0] = SERVER_NAME;
+    execvp(argv[0], const_cast<char* const*>(argv));
+    return EXIT_FAILURE;
+}
@@ -1,29 +1,57 @@
 #include <algorithm>
+#include <atomic>
 #include <charconv>
 #include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <future>
 #include <iomanip>
 #include <iostream>
-#include <sstream>
+#include <map>
+#include <mutex>
+#include <new>
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ahead_behind_cache.hh"
+#include "commit_graph.hh"
+#include "disk_cache.hh"
 #include "focus_utils.hh"
+#include "fsmonitor_client.hh"
+#include "git_status.hh"
 #include "json_logger.hh"
+#include "notification_spool.hh"
+#include "output_buffer.hh"
+#include "prefetch_cache.hh"
+#include "prompt_layout.hh"
+#include "prompt_server.hh"
+#include "prompt_socket.hh"
+#include "prompt_worker.hh"
+#include "startup_profile.hh"
+#include "status_cache.hh"
+#include "status_watcher.hh"
+#include "submodule_status.hh"
+#include "tag_index.hh"
+#include "thread_pool.hh"
+#include "trace_span.hh"
 
 namespace C
 {
 #include <git2.h>
-#ifdef __linux__
-#include <libnotify/notify.h>
-#endif
 }
 
 #if defined __APPLE__
@@ -91,6 +119,7 @@ namespace C
 #define ESCAPE_CODE_GIT_UNTRACKED          ESCAPE_CODE_COOKED("91")
 #define ESCAPE_CODE_GIT_DIRTY              ESCAPE_CODE_COOKED("93")
 #define ESCAPE_CODE_GIT_AHEAD_BEHIND       ESCAPE_CODE_COOKED("2;37")
+#define ESCAPE_CODE_GIT_SUBMODULES         ESCAPE_CODE_COOKED("35")
 #define ESCAPE_CODE_GIT_DESCRIPTION        ESCAPE_CODE_COOKED("32")
 #define ESCAPE_CODE_GIT_DETACHED           ESCAPE_CODE_COOKED("31")
 
@@ -98,6 +127,10 @@ namespace C
 
 static JSONLogger logger;
 
+// Time after starting for which the prompt waits for information (the Git
+// information and the focus state of the terminal) at most.
+static std::chrono::milliseconds constexpr PROMPT_LATENCY_BUDGET(150);
+
 /**
  * Try to convert a string to an integer.
  *
@@ -113,6 +146,85 @@ template <typename T> T try_parse_number(std::string_view view, T otherwise)
     return result;
 }
 
+/**
+ * Obtain the current directory.
+ *
+ * @return Current directory, or an empty string if it cannot be obtained.
+ */
+std::string current_directory(void)
+{
+    std::error_code ec;
+    return std::filesystem::current_path(ec).string();
+}
+
+/**
+ * Git repositories which have already been opened, keyed on the directory they
+ * were opened from. Populated only in server mode, where it is inherited by
+ * the processes serving prompt requests.
+ */
+static std::map<std::string, C::git_repository*> open_repositories;
+
+/**
+ * Open the Git repository containing the given directory. If it has been
+ * opened previously and still exists, reuse it.
+ *
+ * @param directory Directory to start searching from.
+ *
+ * @return Git repository, or a null pointer if there is none.
+ */
+C::git_repository* open_repository(std::string const& directory)
+{
+    auto it = open_repositories.find(directory);
+    if (it != open_repositories.end())
+    {
+        std::error_code ec;
+        if (std::filesystem::is_directory(C::git_repository_path(it->second), ec))
+        {
+            return it->second;
+        }
+        C::git_repository_free(it->second);
+        open_repositories.erase(it);
+    }
+    C::git_repository* repo;
+    if (C::git_repository_open_ext(&repo, directory.data(), 0, nullptr) != 0)
+    {
+        return nullptr;
+    }
+    return repo;
+}
+
+/**
+ * Open the Git repository containing the given directory, and keep it open so
+ * that processes forked hereafter need not open it again. If its working tree
+ * is to be watched, bring the statuses of its files up to date, and if its
+ * HEAD is detached, bring its tag index up to date, for the same reason.
+ *
+ * @param directory Directory to start searching from.
+ */
+void prepare_repository(char const* directory)
+{
+    C::git_repository* repo = open_repository(directory);
+    if (repo == nullptr)
+    {
+        return;
+    }
+    // Don't let the number of open repositories grow without bound.
+    if (open_repositories.size() >= 64 && open_repositories.count(directory) == 0)
+    {
+        for (auto& open_repository : open_repositories)
+        {
+            C::git_repository_free(open_repository.second);
+        }
+        open_repositories.clear();
+    }
+    open_repositories.emplace(directory, repo);
+    StatusWatcher::prepare(repo);
+    if (C::git_repository_head_detached(repo) == 1)
+    {
+        TagIndex::get(repo);
+    }
+}
+
 /**
  * Represent an amount of time.
  */
@@ -126,8 +238,8 @@ private:
 
 public:
     Interval(double);
-    void print_short(std::ostream&) const;
-    void print_long(std::ostream&) const;
+    void print_short(OutputBuffer&) const;
+    void print_long(OutputBuffer&) const;
 };
 
 /**
@@ -143,50 +255,45 @@ Interval::Interval(double delay)
     this->minutes = (remaining /= 60) % 60;
     this->hours = remaining / 60;
     LOG_DEBUG(
-        logger, "Calculated delay",
-        {
-            { "hours", this->hours },
-            { "minutes", this->minutes },
-            { "seconds", this->seconds },
-            { "milliseconds", this->milliseconds },
-        }
+        logger, "Calculated delay", "hours", this->hours, "minutes", this->minutes, "seconds", this->seconds,
+        "milliseconds", this->milliseconds
     );
 }
 
 /**
  * Output the amount of time succinctly.
  *
- * @param ostream Output stream.
+ * @param output_buffer Output buffer.
  */
-void Interval::print_short(std::ostream& ostream) const
+void Interval::print_short(OutputBuffer& output_buffer) const
 {
-    char fill_character = ostream.fill('0');
     if (this->hours > 0)
     {
-        ostream << this->hours << ':';
+        output_buffer << this->hours << ':';
     }
-    ostream << std::setw(2) << this->minutes << ':';
-    ostream << std::setw(2) << this->seconds << '.';
-    ostream << std::setw(3) << this->milliseconds;
-    ostream.fill(fill_character);
+    output_buffer.append_padded(this->minutes, 2);
+    output_buffer << ':';
+    output_buffer.append_padded(this->seconds, 2);
+    output_buffer << '.';
+    output_buffer.append_padded(this->milliseconds, 3);
 }
 
 /**
  * Output the amount of time with units.
  *
- * @param ostream Output stream.
+ * @param output_buffer Output buffer.
  */
-void Interval::print_long(std::ostream& ostream) const
+void Interval::print_long(OutputBuffer& output_buffer) const
 {
     if (this->hours > 0)
     {
-        ostream << this->hours << " h ";
+        output_buffer << this->hours << " h ";
     }
     if (this->hours > 0 || this->minutes > 0)
     {
-        ostream << this->minutes << " m ";
+        output_buffer << this->minutes << " m ";
     }
-    ostream << this->seconds << " s " << this->milliseconds << " ms";
+    output_buffer << this->seconds << " s " << this->milliseconds << " ms";
 }
 
 /**
@@ -203,48 +310,83 @@ private:
     std::string description, tag;
     std::string state;
     unsigned dirty, staged, untracked;
+    StatusLimits status_limits;
     std::size_t ahead, behind;
+    SubmoduleStatus submodule_status;
+    unsigned submodules_dirty, submodules_unknown;
 
 public:
     GitRepository(void);
+    GitRepository(std::string const&);
     std::string get_information(void);
+    bool prefetch_information(void);
+    friend void report_batch_repository(std::string const&, bool, std::mutex&);
+#ifdef BENCHMARK
+    friend int run_benchmark(int const, char const*[]);
+#endif
 
 private:
+    GitRepository(std::string const&, bool);
     void establish_description(void);
     void establish_tag(void);
     void establish_state(void);
     void establish_state_rebasing(void);
     void establish_dirty_staged_untracked(void);
     void establish_ahead_behind(void);
-    // These are static methods because otherwise, their signatures do not
-    // match the required signatures for use as callback functions.
-    static int update_tag(char const*, C::git_oid*, void*);
-    static int update_dirty_staged_untracked(char const*, unsigned, void*);
+    void establish_submodules(void);
 };
 
 /**
  * Read the current Git repository.
  */
-GitRepository::GitRepository(void) :
+GitRepository::GitRepository(void) : GitRepository(current_directory(), true)
+{
+}
+
+/**
+ * Read the Git repository containing the given directory.
+ *
+ * @param directory Directory.
+ */
+GitRepository::GitRepository(std::string const& directory) : GitRepository(directory, true)
+{
+}
+
+/**
+ * Open the Git repository containing the given directory.
+ *
+ * @param directory Directory.
+ * @param establish Whether to also read it. If not, the information about it
+ * must be obtained stage by stage.
+ */
+GitRepository::GitRepository(std::string const& directory, bool establish) :
     repo(nullptr), bare(false), detached(false), ref(nullptr), oid(nullptr), dirty(0), staged(0), untracked(0),
-    ahead(SIZE_MAX), behind(SIZE_MAX)
+    ahead(SIZE_MAX), behind(SIZE_MAX), submodules_dirty(0), submodules_unknown(0)
 {
+    TraceSpan trace_span(__func__);
     if (C::git_libgit2_init() <= 0)
     {
         return;
     }
-    if (C::git_repository_open_ext(&this->repo, ".", 0, nullptr) != 0)
+    if ((this->repo = open_repository(directory)) == nullptr)
     {
         return;
     }
     this->bare = C::git_repository_is_bare(this->repo);
     this->detached = C::git_repository_head_detached(this->repo);
     this->gitdir = C::git_repository_path(this->repo);
+    if (!establish)
+    {
+        return;
+    }
     this->establish_description();
     this->establish_tag();
     this->establish_state();
+    // Scan the submodules while the rest of the work is done.
+    this->submodule_status.start(this->repo);
     this->establish_dirty_staged_untracked();
     this->establish_ahead_behind();
+    this->establish_submodules();
 }
 
 /**
@@ -254,6 +396,7 @@ GitRepository::GitRepository(void) :
  */
 void GitRepository::establish_description(void)
 {
+    TraceSpan trace_span(__func__);
     if (C::git_repository_head(&this->ref, this->repo) == 0)
     {
         // According to the documentation, this retrieves the reference object
@@ -297,6 +440,7 @@ void GitRepository::establish_description(void)
  */
 void GitRepository::establish_tag(void)
 {
+    TraceSpan trace_span(__func__);
     // If a tag or a tagged commit is not checked out (which is the case if we
     // are on a branch), don't search. (This makes the common case fast.) If
     // the most recent commit is not available, there is nothing to search
@@ -305,7 +449,7 @@ void GitRepository::establish_tag(void)
     {
         return;
     }
-    C::git_tag_foreach(this->repo, this->update_tag, this);
+    this->tag = TagIndex::get(this->repo)->find(this->oid);
 }
 
 /**
@@ -314,6 +458,7 @@ void GitRepository::establish_tag(void)
  */
 void GitRepository::establish_state(void)
 {
+    TraceSpan trace_span(__func__);
     switch (C::git_repository_state(this->repo))
     {
     case C::GIT_REPOSITORY_STATE_BISECT:
@@ -364,103 +509,49 @@ void GitRepository::establish_state_rebasing(void)
 
 /**
  * Obtain the statuses of the index and working tree of the current Git
- * repository.
+ * repository. Use the statuses maintained by the server if it is watching the
+ * repository, or those of the paths reported as changed by the file system
+ * monitor configured for the repository, or the cached statuses if they are
+ * still valid.
  */
 void GitRepository::establish_dirty_staged_untracked(void)
 {
-    C::git_status_options opts = GIT_STATUS_OPTIONS_INIT;
-    opts.flags = C::GIT_STATUS_OPT_INCLUDE_UNTRACKED | C::GIT_STATUS_OPT_EXCLUDE_SUBMODULES;
-    C::git_status_foreach_ext(this->repo, &opts, this->update_dirty_staged_untracked, this);
-}
-
-/**
- * Check whether the given tag matches the reference of the given
- * `GitRepository` instance. If it does, update the corresponding member of the
- * latter.
- *
- * @param name Tag name.
- * @param oid Tag object ID.
- * @param self_ `GitRepository` instance whose member should be updated.
- *
- * @return 1 if the tag matches the reference, 0 otherwise.
- */
-int GitRepository::update_tag(char const* name, C::git_oid* oid, void* self_)
-{
-    GitRepository* self = static_cast<GitRepository*>(self_);
-
-    // Compare the object ID of the tag with the object ID of the reference.
-    if (C::git_oid_cmp(oid, self->oid) != 0)
-    {
-        C::git_tag* tag;
-        if (C::git_tag_lookup(&tag, self->repo, oid) != 0)
-        {
-            // This is an unannotated tag, meaning that its object ID is the
-            // same as the object ID of the corresponding commit. The latter
-            // does not match the object ID of the reference.
-            return 0;
-        }
-
-        // This is an annotated tag, meaning that its object ID is different
-        // from the object ID of the corresponding commit. Find the latter and
-        // compare it with the object ID of the reference.
-        C::git_oid const* oid = C::git_tag_target_id(tag);
-        if (C::git_oid_cmp(oid, self->oid) != 0)
-        {
-            // The latter does not match the object ID of the reference.
-            return 0;
-        }
-    }
-
-    self->tag = name;
-    if (self->tag.rfind("refs/tags/", 0) == 0)
+    TraceSpan trace_span(__func__);
+    char const* workdir = C::git_repository_workdir(this->repo);
+    StatusWatcher* status_watcher = workdir == nullptr ? nullptr : StatusWatcher::find(workdir);
+    if (status_watcher != nullptr && status_watcher->peek_counts(this->dirty, this->staged, this->untracked))
     {
-        self->tag.erase(0, 10);
+        return;
     }
-    // Found a match. Stop iterating.
-    return 1;
-}
-
-/**
- * Check whether the given file is modified, staged or untracked. If it is,
- * update the corresponding members of the given `GitRepository` instance.
- *
- * @param path File path.
- * @param status_flags Flags indicating the status of the file.
- * @param self_ `GitRepository` instance whose members should be updated.
- *
- * @return 0.
- */
-int GitRepository::update_dirty_staged_untracked(char const* path, unsigned status_flags, void* self_)
-{
-    GitRepository* self = static_cast<GitRepository*>(self_);
-    if (status_flags
-        & (C::GIT_STATUS_WT_DELETED | C::GIT_STATUS_WT_MODIFIED | C::GIT_STATUS_WT_RENAMED
-           | C::GIT_STATUS_WT_TYPECHANGE))
+    FsmonitorClient fsmonitor_client(this->repo, this->oid);
+    if (fsmonitor_client.get_counts(this->dirty, this->staged, this->untracked))
     {
-        LOG_DEBUG(logger, "Found file in repository", { { "path", path }, { "status", "dirty" } });
-        ++self->dirty;
+        return;
     }
-    if (status_flags
-        & (C::GIT_STATUS_INDEX_DELETED | C::GIT_STATUS_INDEX_MODIFIED | C::GIT_STATUS_INDEX_NEW
-           | C::GIT_STATUS_INDEX_RENAMED | C::GIT_STATUS_INDEX_TYPECHANGE))
+    StatusCache status_cache(this->repo, this->oid);
+    if (status_cache.load(this->dirty, this->staged, this->untracked))
     {
-        LOG_DEBUG(logger, "Found file in repository", { { "path", path }, { "status", "staged" } });
-        ++self->staged;
+        return;
     }
-    if (status_flags & C::GIT_STATUS_WT_NEW)
+    StatusCounts status_counts;
+    if (!scan_status(this->repo, status_counts))
     {
-        LOG_DEBUG(logger, "Found file in repository", { { "path", path }, { "status", "untracked" } });
-        ++self->untracked;
+        return;
     }
-    return 0;
+    this->dirty = status_counts.dirty;
+    this->staged = status_counts.staged;
+    this->untracked = status_counts.untracked;
+    status_cache.store(this->dirty, this->staged, this->untracked, status_counts.untracked_directories);
 }
 
 /**
  * Obtain the number of commits the current branch and the tracked branch
- * differ by.
+ * differ by. Use the cached numbers if these commits have been compared
+ * before.
  */
 void GitRepository::establish_ahead_behind(void)
 {
+    TraceSpan trace_span(__func__);
     if (this->oid == nullptr)
     {
         return;
@@ -478,7 +569,30 @@ void GitRepository::establish_ahead_behind(void)
     {
         return;
     }
-    C::git_graph_ahead_behind(&this->ahead, &this->behind, this->repo, this->oid, upstream_oid);
+    AheadBehindCache ahead_behind_cache(this->repo, this->oid, upstream_oid);
+    if (ahead_behind_cache.load(this->ahead, this->behind))
+    {
+        return;
+    }
+    // Walking the commit-graph is faster, but it may not exist.
+    CommitGraph commit_graph(std::filesystem::path(C::git_repository_commondir(this->repo)) / "objects");
+    if (!commit_graph.ahead_behind(this->repo, this->oid, upstream_oid, this->ahead, this->behind)
+        && C::git_graph_ahead_behind(&this->ahead, &this->behind, this->repo, this->oid, upstream_oid) != 0)
+    {
+        this->ahead = this->behind = SIZE_MAX;
+        return;
+    }
+    ahead_behind_cache.store(this->ahead, this->behind);
+}
+
+/**
+ * Obtain the numbers of submodules which are modified and whose status is not
+ * known, once the submodules have been scanned (if enabled).
+ */
+void GitRepository::establish_submodules(void)
+{
+    TraceSpan trace_span(__func__);
+    this->submodule_status.finish(this->submodules_dirty, this->submodules_unknown);
 }
 
 /**
@@ -489,49 +603,103 @@ void GitRepository::establish_ahead_behind(void)
  */
 std::string GitRepository::get_information(void)
 {
+    TraceSpan trace_span(__func__);
     if (this->repo == nullptr)
     {
         return "";
     }
-    std::ostringstream information_stream;
+    OutputBuffer information_buffer;
     if (this->bare)
     {
-        information_stream << "bare | ";
+        information_buffer << "bare | ";
     }
     if (this->detached)
     {
-        information_stream << ESCAPE_CODE_GIT_DETACHED << this->description << ESCAPE_CODE_COOKED_RESET;
+        information_buffer << ESCAPE_CODE_GIT_DETACHED << this->description << ESCAPE_CODE_COOKED_RESET;
     }
     else
     {
-        information_stream << ESCAPE_CODE_GIT_DESCRIPTION << this->description << ESCAPE_CODE_COOKED_RESET;
+        information_buffer << ESCAPE_CODE_GIT_DESCRIPTION << this->description << ESCAPE_CODE_COOKED_RESET;
     }
     if (!this->tag.empty())
     {
-        information_stream << " 󰓼 " << this->tag;
+        information_buffer << " 󰓼 " << this->tag;
     }
     if (this->dirty > 0)
     {
-        information_stream << " " ESCAPE_CODE_GIT_DIRTY " " << this->dirty << ESCAPE_CODE_COOKED_RESET;
+        information_buffer << " " ESCAPE_CODE_GIT_DIRTY " ";
+        format_status_count(information_buffer, this->dirty, this->status_limits.dirty);
+        information_buffer << ESCAPE_CODE_COOKED_RESET;
     }
     if (this->staged > 0)
     {
-        information_stream << " " ESCAPE_CODE_GIT_STAGED " " << this->staged << ESCAPE_CODE_COOKED_RESET;
+        information_buffer << " " ESCAPE_CODE_GIT_STAGED " ";
+        format_status_count(information_buffer, this->staged, this->status_limits.staged);
+        information_buffer << ESCAPE_CODE_COOKED_RESET;
     }
     if (this->untracked > 0)
     {
-        information_stream << " " ESCAPE_CODE_GIT_UNTRACKED " " << this->untracked << ESCAPE_CODE_COOKED_RESET;
+        information_buffer << " " ESCAPE_CODE_GIT_UNTRACKED " ";
+        format_status_count(information_buffer, this->untracked, this->status_limits.untracked);
+        information_buffer << ESCAPE_CODE_COOKED_RESET;
+    }
+    if (this->submodules_dirty > 0 || this->submodules_unknown > 0)
+    {
+        information_buffer << " " ESCAPE_CODE_GIT_SUBMODULES " " << this->submodules_dirty;
+        if (this->submodules_unknown > 0)
+        {
+            information_buffer << ',' << this->submodules_unknown << '?';
+        }
+        information_buffer << ESCAPE_CODE_COOKED_RESET;
     }
     if (this->ahead != SIZE_MAX && this->behind != SIZE_MAX)
     {
-        information_stream << " " ESCAPE_CODE_GIT_AHEAD_BEHIND " +" << this->ahead << ",−" << this->behind
+        information_buffer << " " ESCAPE_CODE_GIT_AHEAD_BEHIND " +" << this->ahead << ",−" << this->behind
                            << ESCAPE_CODE_COOKED_RESET;
     }
     if (!this->state.empty())
     {
-        information_stream << " | " << this->state;
+        information_buffer << " | " << this->state;
+    }
+    return std::string(information_buffer.view());
+}
+
+/**
+ * Remember the information about the current Git repository, for prompts which
+ * cannot wait for it to be obtained.
+ *
+ * @return Whether there was a Git repository.
+ */
+bool GitRepository::prefetch_information(void)
+{
+    TraceSpan trace_span(__func__);
+    if (this->repo == nullptr)
+    {
+        return false;
+    }
+    PrefetchCache(this->repo).store(this->get_information());
+    return true;
+}
+
+/**
+ * Obtain the information about the current Git repository remembered by a
+ * previous prefetch, if it is still valid. Unlike obtaining it afresh, this is
+ * quick.
+ *
+ * @return Git information, or an empty string.
+ */
+std::string get_prefetched_information(void)
+{
+    TraceSpan trace_span(__func__);
+    std::string information;
+    C::git_repository* repo;
+    if (C::git_libgit2_init() <= 0 || C::git_repository_open_ext(&repo, current_directory().data(), 0, nullptr) != 0)
+    {
+        return information;
     }
-    return information_stream.str();
+    PrefetchCache(repo).load(information);
+    C::git_repository_free(repo);
+    return information;
 }
 
 /**
@@ -543,24 +711,35 @@ std::string GitRepository::get_information(void)
  */
 void notify_desktop(std::string_view const& last_command, int exit_code, Interval const& interval)
 {
-    std::ostringstream description_stream;
-    description_stream << "exit " << exit_code << " in ";
-    interval.print_long(description_stream);
-    std::string description = description_stream.str();
-    LOG_DEBUG(logger, "Sending notification", { { "title", last_command }, { "subtitle", description } });
+    TraceSpan trace_span(__func__);
+    OutputBuffer description_buffer;
+    description_buffer << "exit " << exit_code << " in ";
+    interval.print_long(description_buffer);
+    std::string description(description_buffer.view());
+    LOG_DEBUG(logger, "Sending notification", "title", last_command, "subtitle", description);
 #if defined __APPLE__ || defined _WIN32
     // Use OSC 777, which is supported on Kitty and Wezterm, the terminals I
     // use on these systems respectively.
-    std::clog << ESCAPE RIGHT_SQUARE_BRACKET "777;notify;" << last_command << ';' << description << ESCAPE BACKSLASH;
+    // Shorten the command, or the string terminator may not fit in the
+    // buffer, leaving the terminal waiting for it.
+    std::size_t constexpr notification_command_max_size = 4096;
+    OutputBuffer notification_buffer;
+    notification_buffer << ESCAPE RIGHT_SQUARE_BRACKET "777;notify;";
+    if (last_command.size() <= notification_command_max_size)
+    {
+        notification_buffer << last_command;
+    }
+    else
+    {
+        notification_buffer << last_command.substr(0, notification_command_max_size) << " ...";
+    }
+    notification_buffer << ';' << description << ESCAPE BACKSLASH;
+    notification_buffer.write_to(fileno(stderr));
 #else
     // Xfce Terminal (the best terminal) does not support OSC 777. Do it the
-    // hard way.
-    C::notify_init("Terminal");
-    C::NotifyNotification* notif = C::notify_notification_new(
-        last_command.data(), description.data(), exit_code == 0 ? "dialog-information" : "dialog-error"
-    );
-    C::notify_notification_show(notif, nullptr);
-    // C::notify_uninit();
+    // hard way, in a helper process, because the notification daemon may be
+    // slow to respond.
+    spool_notification(last_command, description, exit_code == 0 ? "dialog-information" : "dialog-error");
 #endif
 }
 
@@ -574,32 +753,33 @@ void notify_desktop(std::string_view const& last_command, int exit_code, Interva
  */
 void write_report(std::string_view const& last_command, int exit_code, Interval const& interval, std::size_t columns)
 {
+    TraceSpan trace_span(__func__);
     std::size_t left_piece_len = columns * 3 / 8;
     std::size_t right_piece_len = left_piece_len;
-    std::ostringstream report_stream;
+    OutputBuffer report_buffer;
     if (last_command.size() <= left_piece_len + right_piece_len + 5)
     {
-        report_stream << ESCAPE_CODE_COMMAND_HISTORY HISTORY_ICON ESCAPE_CODE_RAW_RESET " " << last_command;
+        report_buffer << ESCAPE_CODE_COMMAND_HISTORY HISTORY_ICON ESCAPE_CODE_RAW_RESET " " << last_command;
     }
     else
     {
         LOG_DEBUG(
-            logger, "Breaking command into pieces",
-            { { "left_piece_len", left_piece_len }, { "right_piece_len", right_piece_len } }
+            logger, "Breaking command into pieces", "left_piece_len", left_piece_len,
+            "right_piece_len", right_piece_len
         );
-        report_stream << ESCAPE_CODE_COMMAND_HISTORY HISTORY_ICON ESCAPE_CODE_RAW_RESET " "
+        report_buffer << ESCAPE_CODE_COMMAND_HISTORY HISTORY_ICON ESCAPE_CODE_RAW_RESET " "
                       << last_command.substr(0, left_piece_len);
-        report_stream << " ... " << last_command.substr(last_command.size() - right_piece_len);
+        report_buffer << " ... " << last_command.substr(last_command.size() - right_piece_len);
     }
     if (exit_code == 0)
     {
-        report_stream << " " ESCAPE_CODE_COMMAND_SUCCESS SUCCESS_ICON ESCAPE_CODE_RAW_RESET " ";
+        report_buffer << " " ESCAPE_CODE_COMMAND_SUCCESS SUCCESS_ICON ESCAPE_CODE_RAW_RESET " ";
     }
     else
     {
-        report_stream << " " ESCAPE_CODE_COMMAND_FAILURE FAILURE_ICON ESCAPE_CODE_RAW_RESET " ";
+        report_buffer << " " ESCAPE_CODE_COMMAND_FAILURE FAILURE_ICON ESCAPE_CODE_RAW_RESET " ";
     }
-    interval.print_short(report_stream);
+    interval.print_short(report_buffer);
 
     // Determine the number of UTF-8 code points in the report. The C++
     // standard does not specify a UTF-8 encoding (or any encoding for that
@@ -609,7 +789,7 @@ void write_report(std::string_view const& last_command, int exit_code, Interval
     // (whence their encoding doesn't matter, since they will just be output
     // without processing). Consequently, counting like this should result in
     // correct output in a UTF-8 terminal.
-    std::string report = report_stream.str();
+    std::string_view report = report_buffer.view();
     std::size_t report_size = std::count_if(
         report.cbegin(), report.cend(),
         [](char const& report_char)
@@ -617,7 +797,7 @@ void write_report(std::string_view const& last_command, int exit_code, Interval
             return (report_char & 0xC0) != 0x80;
         }
     );
-    LOG_DEBUG(logger, "Constructed report", { { "bytes", report.size() }, { "code_points", report_size } });
+    LOG_DEBUG(logger, "Constructed report", "bytes", report.size(), "code_points", report_size);
 
     // Ensure that the text is right-aligned. Compensate for multi-byte
     // characters and non-printing sequences.
@@ -627,8 +807,15 @@ void write_report(std::string_view const& last_command, int exit_code, Interval
            - 4)
         / sizeof(char);
     std::size_t width = columns + multi_byte_correction + non_printing_correction;
-    LOG_DEBUG(logger, "Padding report", { { "width", width } });
-    std::clog << '\r' << std::setw(width) << report << '\n';
+    LOG_DEBUG(logger, "Padding report", "width", width);
+    OutputBuffer line_buffer;
+    line_buffer << '\r';
+    for (std::size_t padding = report.size(); padding < width; ++padding)
+    {
+        line_buffer << ' ';
+    }
+    line_buffer << report << '\n';
+    line_buffer.write_to(fileno(stderr));
 }
 
 /**
@@ -638,12 +825,16 @@ void write_report(std::string_view const& last_command, int exit_code, Interval
  * @param exit_code Code with which the command exited.
  * @param delay Running time of the command in seconds.
  * @param columns Width of the terminal window.
+ * @param deadline Time after which the focus state of the terminal is not
+ * awaited.
  */
-void report_command_status(std::string_view& last_command, int exit_code, double delay, std::size_t columns)
+void report_command_status(
+    std::string_view& last_command, int exit_code, double delay, std::size_t columns,
+    std::chrono::steady_clock::time_point deadline
+)
 {
     LOG_DEBUG(
-        logger, "Obtained last command details",
-        { { "command", last_command }, { "exit_code", exit_code }, { "seconds", delay } }
+        logger, "Obtained last command details", "command", last_command, "exit_code", exit_code, "seconds", delay
     );
     if (delay <= 5)
     {
@@ -659,14 +850,21 @@ void report_command_status(std::string_view& last_command, int exit_code, double
     last_command.remove_prefix(last_command.find_first_not_of(' '));
     last_command.remove_suffix(last_command.size() - 1 - last_command.find_last_not_of(' '));
 
+    // Ask the terminal whether it has focus before writing the report, so
+    // that it answers while the report is being written.
+    FocusProbe focus_probe;
+    if (delay > 10)
+    {
+        focus_probe.start();
+    }
     Interval interval(delay);
     write_report(last_command, exit_code, interval, columns);
     if (delay <= 10)
     {
         return;
     }
-    bool terminal_focused = terminal_has_focus();
-    LOG_DEBUG(logger, "Obtained focus details", { { "terminal_focused", terminal_focused } });
+    bool terminal_focused = focus_probe.has_focus(deadline);
+    LOG_DEBUG(logger, "Obtained focus details", "terminal_focused", terminal_focused);
     if (!terminal_focused)
     {
         notify_desktop(last_command, exit_code, interval);
@@ -674,137 +872,955 @@ void report_command_status(std::string_view& last_command, int exit_code, double
 }
 
 /**
- * Set the title of the current terminal window (which should automatically set
- * the title of the current terminal tab). Show the primary prompt.
- *
- * The terminal title will be set to the basename of the current directory
- * followed by a slash, unless the current directory is the Linux/macOS root
- * directory: in which case, the title will be set to just a slash.
- *
- * The primary prompt will contain the current directory in full, unless the
- * terminal is narrow: in which case, it will contain the basename of the
- * current directory.
- *
- * @param pwd Current directory.
- * @param columns Width of the terminal window.
- * @param shlvl Current shell level.
- * @param git_repository_information_future Git information provider.
- * @param venv_view Python virtual environment.
+ * Information shown in the primary prompt.
  */
-void set_terminal_title_display_primary_prompt(
-    std::size_t columns, std::string_view& pwd, int shlvl, std::future<std::string>& git_repository_information_future,
-    std::string_view& venv_view
-)
+struct PromptContext
 {
-    LOG_DEBUG(logger, "Obtained present working directory", { { "pwd", pwd } });
-    std::size_t pwd_size = pwd.size();
-    pwd.remove_prefix(pwd.rfind('/') + 1);
-    std::clog << ESCAPE RIGHT_SQUARE_BRACKET "0;" << pwd << '/' << ESCAPE BACKSLASH;
+    bool narrow;
+    std::string_view git_repository_information;
+    std::string_view venv_view;
+    int shlvl;
+};
 
-    // Just a heuristic. The portion of the path up to the home directory gets
-    // replaced with a tilde in my current configuration, so this is in no way
-    // precise.
-    if (pwd_size > 5 * columns / 8)
+/**
+ * Separator between the segments of the line showing the current directory,
+ * etc.
+ */
+struct InformationSeparator
+{
+    static constexpr StaticString value{ "  " };
+};
+
+/**
+ * Separator between the segments of the line the user types on.
+ */
+struct InputSeparator
+{
+    static constexpr StaticString value{ "" };
+};
+
+/**
+ * Host name. Not shown if the terminal is narrow.
+ */
+struct HostSegment
+{
+    static constexpr StaticString prefix{ HOST_ICON " " ESCAPE_CODE_HOST HOST ESCAPE_CODE_COOKED_RESET };
+    static constexpr StaticString suffix{ "" };
+    static bool is_shown(PromptContext const& context)
     {
-        LOG_DEBUG(
-            logger, "Displaying basename of current directory in prompt",
-            { { "pwd_size", pwd_size }, { "columns", columns } }
-        );
-        std::cout << "\n " ESCAPE_CODE_DIRECTORY SHORT_DIRECTORY ESCAPE_CODE_COOKED_RESET;
+        return !context.narrow;
     }
-    else
+    static void render(OutputBuffer&, PromptContext const&)
     {
-        LOG_DEBUG(
-            logger, "Displaying full path of current directory in prompt",
-            { { "pwd_size", pwd_size }, { "columns", columns } }
-        );
-        std::cout << "\n" HOST_ICON " " ESCAPE_CODE_HOST HOST ESCAPE_CODE_COOKED_RESET
-                     "  " ESCAPE_CODE_DIRECTORY DIRECTORY ESCAPE_CODE_COOKED_RESET;
     }
-    if (git_repository_information_future.wait_for(std::chrono::milliseconds(150)) != std::future_status::ready)
+};
+
+/**
+ * Full path of the current directory. Not shown if the terminal is narrow.
+ */
+struct DirectorySegment
+{
+    static constexpr StaticString prefix{ ESCAPE_CODE_DIRECTORY DIRECTORY ESCAPE_CODE_COOKED_RESET };
+    static constexpr StaticString suffix{ "" };
+    static bool is_shown(PromptContext const& context)
     {
-        std::cout << "  " << ESCAPE_CODE_GIT_STATUS_UNAVAILABLE "unavailable" ESCAPE_CODE_COOKED_RESET;
+        return !context.narrow;
     }
-    else
+    static void render(OutputBuffer&, PromptContext const&)
     {
-        std::string git_repository_information = git_repository_information_future.get();
-        if (!git_repository_information.empty())
-        {
-            std::cout << "  " << git_repository_information;
-        }
     }
-    if (!venv_view.empty())
+};
+
+/**
+ * Basename of the current directory. Shown only if the terminal is narrow.
+ */
+struct ShortDirectorySegment
+{
+    static constexpr StaticString prefix{ " " ESCAPE_CODE_DIRECTORY SHORT_DIRECTORY ESCAPE_CODE_COOKED_RESET };
+    static constexpr StaticString suffix{ "" };
+    static bool is_shown(PromptContext const& context)
     {
-        std::cout << "  " ESCAPE_CODE_VIRTUAL_ENVIRONMENT << venv_view << ESCAPE_CODE_COOKED_RESET;
+        return context.narrow;
     }
-    std::cout << "\n";
-    while (--shlvl > 0)
+    static void render(OutputBuffer&, PromptContext const&)
     {
-        std::cout << "▶";
     }
-    std::cout << PROMPT_SYMBOL " ";
-}
+};
 
 /**
- * Actual entry point. The C++ standard forbids recursively calling `main`, so
- * the program code is written in this function instead.
- *
- * @param argc Number of command line arguments.
- * @param argv Command line arguments.
- *
- * @return Exit code.
+ * Information about the current Git repository (or a placeholder), which is
+ * already coloured.
  */
-int main_internal(int const argc, char const* argv[])
+struct GitSegment
 {
-    // Start another thread to obtain information about the current Git
-    // repository.
-    std::promise<std::string> git_repository_information_promise;
-    std::future<std::string> git_repository_information_future = git_repository_information_promise.get_future();
-    std::thread(
-        [](std::promise<std::string> git_repository_information_promise)
-        {
-            git_repository_information_promise.set_value(GitRepository().get_information());
-        },
-        // I prefer to transfer ownership of the promise to the thread, because
-        // it may continue running after the main thread terminates.
-        std::move(git_repository_information_promise)
-    )
-        .detach();
+    static constexpr StaticString prefix{ "" };
+    static constexpr StaticString suffix{ "" };
+    static bool is_shown(PromptContext const& context)
+    {
+        return !context.git_repository_information.empty();
+    }
+    static void render(OutputBuffer& output_buffer, PromptContext const& context)
+    {
+        output_buffer << context.git_repository_information;
+    }
+};
 
-    std::string_view last_command(argv[1]);
-    int exit_code = try_parse_number(argv[2], 1);
-    // Support for parsing floating-point numbers is not consistent across
-    // standard library implementations, so use a different function.
-    double begin_ts = std::strtod(argv[3], nullptr);
-    double end_ts = std::strtod(argv[4], nullptr);
-    double delay = end_ts - begin_ts;
-    std::size_t columns = try_parse_number(argv[5], 79);
-    report_command_status(last_command, exit_code, delay, columns);
+/**
+ * Python virtual environment.
+ */
+struct VirtualEnvironmentSegment
+{
+    static constexpr StaticString prefix{ ESCAPE_CODE_VIRTUAL_ENVIRONMENT };
+    static constexpr StaticString suffix{ ESCAPE_CODE_COOKED_RESET };
+    static bool is_shown(PromptContext const& context)
+    {
+        return !context.venv_view.empty();
+    }
+    static void render(OutputBuffer& output_buffer, PromptContext const& context)
+    {
+        output_buffer << context.venv_view;
+    }
+};
 
-    std::string_view pwd(argv[6]);
-    int shlvl = try_parse_number(argv[7], 1);
-    std::string_view venv_view;
-    char const* venv;
-    if ((venv = getenv("VIRTUAL_ENV_PROMPT")) != nullptr)
+/**
+ * One marker for each shell this shell is nested in.
+ */
+struct ShellLevelSegment
+{
+    static constexpr StaticString prefix{ "" };
+    static constexpr StaticString suffix{ "" };
+    static bool is_shown(PromptContext const& context)
     {
-        venv_view = venv;
+        return context.shlvl > 1;
     }
-    else if ((venv = getenv("VIRTUAL_ENV")) != nullptr)
+    static void render(OutputBuffer& output_buffer, PromptContext const& context)
     {
-        venv_view = venv;
-        venv_view.remove_prefix(venv_view.rfind('/') + 1);
+        for (int shlvl = context.shlvl; --shlvl > 0;)
+        {
+            output_buffer << "▶";
+        }
     }
-    set_terminal_title_display_primary_prompt(columns, pwd, shlvl, git_repository_information_future, venv_view);
+};
 
-    return EXIT_SUCCESS;
-}
+/**
+ * Prompt symbol, after which the user types.
+ */
+struct PromptSymbolSegment
+{
+    static constexpr StaticString prefix{ PROMPT_SYMBOL " " };
+    static constexpr StaticString suffix{ "" };
+    static bool is_shown(PromptContext const&)
+    {
+        return true;
+    }
+    static void render(OutputBuffer&, PromptContext const&)
+    {
+    }
+};
 
-int main(int const argc, char const* argv[])
+// Layout of the primary prompt. Rearrange, add or remove segments here to
+// customise it.
+using InformationLine = PromptLine<
+    InformationSeparator, HostSegment, DirectorySegment, ShortDirectorySegment, GitSegment, VirtualEnvironmentSegment>;
+using InputLine = PromptLine<InputSeparator, ShellLevelSegment, PromptSymbolSegment>;
+
+/**
+ * Collect the information to show in the primary prompt. The current directory
+ * will be shown in full, unless the terminal is narrow: in which case, only its
+ * basename will be shown.
+ *
+ * @param columns Width of the terminal window.
+ * @param pwd_size Length of the current directory.
+ * @param git_repository_information Git information (or a placeholder).
+ * @param venv_view Python virtual environment.
+ * @param shlvl Current shell level.
+ *
+ * @return Information shown in the primary prompt.
+ */
+PromptContext build_prompt_context(
+    std::size_t columns, std::size_t pwd_size, std::string_view git_repository_information,
+    std::string_view venv_view, int shlvl
+)
 {
+    // Just a heuristic. The portion of the path up to the home directory gets
+    // replaced with a tilde in my current configuration, so this is in no way
+    // precise.
+    bool narrow = pwd_size > 5 * columns / 8;
+    if (narrow)
+    {
+        LOG_DEBUG(
+            logger, "Displaying basename of current directory in prompt", "pwd_size", pwd_size, "columns", columns
+        );
+    }
+    else
+    {
+        LOG_DEBUG(
+            logger, "Displaying full path of current directory in prompt", "pwd_size", pwd_size, "columns", columns
+        );
+    }
+    return { narrow, git_repository_information, venv_view, shlvl };
+}
+
+/**
+ * Construct the line of the primary prompt which shows the host, the current
+ * directory, information about the current Git repository and the Python
+ * virtual environment.
+ *
+ * @param output_buffer Output buffer to write the line (without a line break)
+ * to.
+ * @param context Information shown in the primary prompt.
+ */
+void render_information_line(OutputBuffer& output_buffer, PromptContext const& context)
+{
+    TraceSpan trace_span(__func__);
+    InformationLine::render(output_buffer, context);
+}
+
+/**
+ * Construct the primary prompt.
+ *
+ * @param output_buffer Output buffer to write the primary prompt to.
+ * @param context Information shown in the primary prompt.
+ */
+void render_primary_prompt(OutputBuffer& output_buffer, PromptContext const& context)
+{
+    TraceSpan trace_span(__func__);
+    output_buffer << '\n';
+    render_information_line(output_buffer, context);
+    output_buffer << '\n';
+    InputLine::render(output_buffer, context);
+}
+
+#ifndef _WIN32
+#if defined BASH
+/**
+ * Expand what Bash would have expanded in the given line of the primary
+ * prompt, and drop the markers of non-printing sequences, so that the line can
+ * be written to the terminal directly.
+ *
+ * @param output_buffer Output buffer to write the expanded line to.
+ * @param information_line Line showing the current directory, etc.
+ * @param pwd Current directory.
+ */
+void expand_information_line(OutputBuffer& output_buffer, std::string_view information_line, std::string_view pwd)
+{
+    char hostname[256] = {};
+    gethostname(hostname, sizeof hostname / sizeof *hostname - 1);
+    std::string_view host(hostname);
+    host = host.substr(0, host.find('.'));
+    std::string directory(pwd);
+    char const* home = std::getenv("HOME");
+    if (home != nullptr && *home != '\0' && pwd.rfind(home, 0) == 0
+        && (pwd.size() == std::strlen(home) || pwd[std::strlen(home)] == '/'))
+    {
+        directory.replace(0, std::strlen(home), "~");
+    }
+
+    for (std::size_t i = 0; i < information_line.size(); ++i)
+    {
+        char c = information_line[i];
+        if (c == BEGIN_INVISIBLE[0] || c == END_INVISIBLE[0])
+        {
+            continue;
+        }
+        if (c != '\\' || i + 1 == information_line.size())
+        {
+            output_buffer << c;
+            continue;
+        }
+        switch (information_line[++i])
+        {
+        case 'h':
+            output_buffer << host;
+            break;
+        case 'w':
+            output_buffer << directory;
+            break;
+        case 'W':
+            output_buffer << (directory == "/" ? directory : directory.substr(directory.rfind('/') + 1));
+            break;
+        default:
+            output_buffer << c << information_line[i];
+        }
+    }
+}
+
+/**
+ * Redraw the line of the primary prompt showing the current directory, etc. in
+ * place. This is done only if the user has not started running a command since
+ * the prompt was drawn, which the shell records by touching a stamp file.
+ *
+ * @param information_line Line showing the current directory, etc.
+ * @param pwd Current directory.
+ * @param stamp_path Stamp file.
+ * @param stamp_mtime Modification time of the stamp file when the prompt was
+ * drawn.
+ */
+void redraw_information_line(
+    std::string_view information_line, std::string_view pwd, char const* stamp_path, std::int64_t stamp_mtime
+)
+{
+    if (modification_time(stamp_path) != stamp_mtime)
+    {
+        LOG_DEBUG(logger, "Not redrawing outdated prompt", "stamp_path", stamp_path);
+        return;
+    }
+    // Save the cursor position, move to the start of the previous line, clear
+    // it, write the new line and restore the cursor position. The cursor is
+    // on the last line of the prompt, right after which the user types.
+    OutputBuffer redraw_buffer;
+    redraw_buffer << ESCAPE "7" ESCAPE LEFT_SQUARE_BRACKET "1A\r" ESCAPE LEFT_SQUARE_BRACKET "2K";
+    expand_information_line(redraw_buffer, information_line, pwd);
+    redraw_buffer << ESCAPE "8";
+    redraw_buffer.write_to(STDERR_FILENO);
+}
+#elif defined ZSH
+/**
+ * Send the primary prompt to the shell, which reads it from a FIFO when idle
+ * and redraws the prompt. The shell ignores prompts meant for a different
+ * prompt than the current one.
+ *
+ * @param message_buffer Output buffer containing the identifier of the prompt
+ * the primary prompt is meant for, a null character, the primary prompt and a
+ * null character.
+ * @param fifo_path FIFO the shell reads from.
+ */
+void redraw_primary_prompt(OutputBuffer const& message_buffer, char const* fifo_path)
+{
+    int fd = open(fifo_path, O_WRONLY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        return;
+    }
+    message_buffer.write_to(fd);
+    close(fd);
+}
+#endif
+#endif
+
+/**
+ * Start obtaining information about the current Git repository in a child
+ * process, which redraws the primary prompt once it has the information if the
+ * prompt could not wait for it. This is enabled only if the environment
+ * variable `CUSTOM_PROMPT_ASYNC` is set to a non-zero number, and the shell
+ * has set up a channel to redraw the prompt through (see `.bash_aliases` and
+ * `.zshrc`).
+ *
+ * @param prompt_worker Worker to start.
+ * @param git_repository_information_promise Promise to fulfil with the Git
+ * information.
+ * @param columns Width of the terminal window.
+ * @param pwd Current directory.
+ * @param shlvl Current shell level.
+ * @param venv_view Python virtual environment.
+ * @param prompt_id Identifier of the prompt.
+ *
+ * @return Whether the worker was started.
+ */
+bool start_prompt_worker(
+    PromptWorker& prompt_worker, std::promise<std::string>& git_repository_information_promise, std::size_t columns,
+    std::string_view pwd, int shlvl, std::string_view venv_view, char const* prompt_id
+)
+{
+#ifdef _WIN32
+    return false;
+#else
+#if defined BASH
+    char const* channel = std::getenv("CUSTOM_PROMPT_ASYNC_STAMP");
+#elif defined ZSH
+    char const* channel = std::getenv("CUSTOM_PROMPT_ASYNC_FIFO");
+#endif
+    if (!PromptWorker::is_enabled() || channel == nullptr || *channel == '\0')
+    {
+        return false;
+    }
+#ifdef BASH
+    std::int64_t stamp_mtime = modification_time(channel);
+#endif
+    return prompt_worker.start(
+        []
+        {
+            return GitRepository().get_information();
+        },
+        [=](std::string const& git_repository_information)
+        {
+#if defined BASH
+            OutputBuffer information_line_buffer;
+            render_information_line(
+                information_line_buffer,
+                build_prompt_context(columns, pwd.size(), git_repository_information, venv_view, shlvl)
+            );
+            redraw_information_line(information_line_buffer.view(), pwd, channel, stamp_mtime);
+#elif defined ZSH
+            OutputBuffer message_buffer;
+            message_buffer << prompt_id << '\0';
+            render_primary_prompt(
+                message_buffer, build_prompt_context(columns, pwd.size(), git_repository_information, venv_view, shlvl)
+            );
+            message_buffer << '\0';
+            redraw_primary_prompt(message_buffer, channel);
+#endif
+        },
+        git_repository_information_promise
+    );
+#endif
+}
+
+/**
+ * Set the title of the current terminal window (which should automatically set
+ * the title of the current terminal tab). Show the primary prompt.
+ *
+ * The terminal title will be set to the basename of the current directory
+ * followed by a slash, unless the current directory is the Linux/macOS root
+ * directory: in which case, the title will be set to just a slash.
+ *
+ * @param pwd Current directory.
+ * @param columns Width of the terminal window.
+ * @param shlvl Current shell level.
+ * @param git_repository_information_future Git information provider.
+ * @param prompt_worker Worker providing the Git information, if any.
+ * @param venv_view Python virtual environment.
+ * @param deadline Time after which the Git information is not awaited.
+ */
+void set_terminal_title_display_primary_prompt(
+    std::size_t columns, std::string_view& pwd, int shlvl, std::future<std::string>& git_repository_information_future,
+    PromptWorker& prompt_worker, std::string_view& venv_view, std::chrono::steady_clock::time_point deadline
+)
+{
+    TraceSpan trace_span(__func__);
+    LOG_DEBUG(logger, "Obtained present working directory", "pwd", pwd);
+    std::size_t pwd_size = pwd.size();
+    pwd.remove_prefix(pwd.rfind('/') + 1);
+    OutputBuffer title_buffer;
+    title_buffer << ESCAPE RIGHT_SQUARE_BRACKET "0;" << pwd << '/' << ESCAPE BACKSLASH;
+    title_buffer.write_to(fileno(stderr));
+
+    // If the Git information is not ready yet, have the fallback ready before
+    // waiting for it, so that nothing remains to be done once the deadline
+    // passes.
+    std::string git_repository_information;
+    if (git_repository_information_future.wait_for(std::chrono::seconds::zero()) != std::future_status::ready)
+    {
+        git_repository_information = get_prefetched_information();
+    }
+    if (git_repository_information_future.wait_until(deadline) != std::future_status::ready)
+    {
+        // If the worker was started, it will redraw the prompt later. Until
+        // then, show the information obtained in advance, if any, marked as
+        // such, because changes to the working tree since are not noticed.
+        prompt_worker.settle(false);
+        if (!git_repository_information.empty())
+        {
+            git_repository_information += " | ";
+        }
+        git_repository_information += prompt_worker.is_running()
+            ? ESCAPE_CODE_GIT_STATUS_UNAVAILABLE "pending" ESCAPE_CODE_COOKED_RESET
+            : ESCAPE_CODE_GIT_STATUS_UNAVAILABLE "unavailable" ESCAPE_CODE_COOKED_RESET;
+    }
+    else
+    {
+        prompt_worker.settle(true);
+        git_repository_information = git_repository_information_future.get();
+    }
+    OutputBuffer primary_prompt_buffer;
+    render_primary_prompt(
+        primary_prompt_buffer, build_prompt_context(columns, pwd_size, git_repository_information, venv_view, shlvl)
+    );
+    primary_prompt_buffer.write_to(fileno(stdout));
+}
+
+/**
+ * Actual entry point. The C++ standard forbids recursively calling `main`, so
+ * the program code is written in this function instead.
+ *
+ * @param argc Number of command line arguments.
+ * @param argv Command line arguments.
+ *
+ * @return Exit code.
+ */
+int main_internal(int const argc, char const* argv[])
+{
+    TraceSpan trace_span(__func__);
+    auto deadline = std::chrono::steady_clock::now() + PROMPT_LATENCY_BUDGET;
+    std::string_view last_command(argv[1]);
+    int exit_code = try_parse_number(argv[2], 1);
+    // Support for parsing floating-point numbers is not consistent across
+    // standard library implementations, so use a different function.
+    double begin_ts = std::strtod(argv[3], nullptr);
+    double end_ts = std::strtod(argv[4], nullptr);
+    double delay = end_ts - begin_ts;
+    std::size_t columns = try_parse_number(argv[5], 79);
+    std::string_view pwd(argv[6]);
+    int shlvl = try_parse_number(argv[7], 1);
+    std::string_view venv_view;
+    char const* venv;
+    if ((venv = getenv("VIRTUAL_ENV_PROMPT")) != nullptr)
+    {
+        venv_view = venv;
+    }
+    else if ((venv = getenv("VIRTUAL_ENV")) != nullptr)
+    {
+        venv_view = venv;
+        venv_view.remove_prefix(venv_view.rfind('/') + 1);
+    }
+
+    // Obtain information about the current Git repository in a child process
+    // (which must be started before any other threads) or in another thread.
+    std::promise<std::string> git_repository_information_promise;
+    std::future<std::string> git_repository_information_future = git_repository_information_promise.get_future();
+    PromptWorker prompt_worker;
+    if (!start_prompt_worker(
+            prompt_worker, git_repository_information_promise, columns, pwd, shlvl, venv_view, argv[4]
+        ))
+    {
+        std::thread(
+            [](std::promise<std::string> git_repository_information_promise)
+            {
+                git_repository_information_promise.set_value(GitRepository().get_information());
+            },
+            // I prefer to transfer ownership of the promise to the thread,
+            // because it may continue running after the main thread
+            // terminates.
+            std::move(git_repository_information_promise)
+        )
+            .detach();
+    }
+
+    report_command_status(last_command, exit_code, delay, columns, deadline);
+    set_terminal_title_display_primary_prompt(
+        columns, pwd, shlvl, git_repository_information_future, prompt_worker, venv_view, deadline
+    );
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Write Git information without the markers of non-printing sequences, which
+ * only the shell understands, and, if requested, without colours.
+ *
+ * @param output_buffer Output buffer to write the information to.
+ * @param information Git information.
+ * @param colour Whether to keep the colours.
+ */
+void write_plain_information(OutputBuffer& output_buffer, std::string_view information, bool colour)
+{
+    std::string_view begin_invisible(BEGIN_INVISIBLE), end_invisible(END_INVISIBLE);
+    for (std::size_t i = 0; i < information.size(); ++i)
+    {
+        if (information.compare(i, begin_invisible.size(), begin_invisible) == 0)
+        {
+            i += begin_invisible.size() - 1;
+        }
+        else if (information.compare(i, end_invisible.size(), end_invisible) == 0)
+        {
+            i += end_invisible.size() - 1;
+        }
+        else if (!colour && information[i] == ESCAPE[0])
+        {
+            i = std::min(information.find('m', i), information.size());
+        }
+        else
+        {
+            output_buffer << information[i];
+        }
+    }
+}
+
+/**
+ * Obtain information about a Git repository and write it on a line of its own,
+ * after the directory it was looked for in. Called on a thread of the pool.
+ *
+ * @param directory Directory.
+ * @param colour Whether to keep the colours.
+ * @param output_mutex Mutex held while writing, so that lines are not mixed up.
+ */
+void report_batch_repository(std::string const& directory, bool colour, std::mutex& output_mutex)
+{
+    TraceSpan trace_span(__func__);
+    GitRepository git_repository(directory);
+    std::string information = git_repository.get_information();
+    // Many repositories are read, so don't keep them open.
+    C::git_reference_free(git_repository.ref);
+    C::git_repository_free(git_repository.repo);
+    OutputBuffer line_buffer;
+    line_buffer << directory << '\t';
+    write_plain_information(line_buffer, information, colour);
+    line_buffer << '\n';
+    std::lock_guard<std::mutex> lock(output_mutex);
+    line_buffer.write_to(fileno(stdout));
+}
+
+/**
+ * Find the Git repositories in a directory tree: the directory itself if it is
+ * the top of a working tree, or else those below it. Neither working trees
+ * (whose submodules are not of interest) nor hidden directories are searched.
+ *
+ * @param root Directory.
+ * @param found Function to call with each directory found.
+ */
+void find_batch_repositories(std::filesystem::path const& root, std::function<void(std::string const&)> const& found)
+{
+    std::error_code ec;
+    if (std::filesystem::exists(root / ".git", ec))
+    {
+        found(root.string());
+        return;
+    }
+    std::filesystem::recursive_directory_iterator it(
+        root, std::filesystem::directory_options::skip_permission_denied, ec
+    );
+    for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+    {
+        std::error_code entry_ec;
+        if (it->is_symlink(entry_ec) || !it->is_directory(entry_ec))
+        {
+            continue;
+        }
+        if (it->path().filename().string().rfind('.', 0) == 0)
+        {
+            it.disable_recursion_pending();
+        }
+        else if (std::filesystem::exists(it->path() / ".git", entry_ec))
+        {
+            it.disable_recursion_pending();
+            found(it->path().string());
+        }
+    }
+}
+
+/**
+ * Report the Git information of many Git repositories, one line per
+ * repository, written as soon as each is read. As many are read at a time
+ * as there are cores, while more are still being looked for.
+ *
+ * @param argc Number of directories.
+ * @param argv Directories to find Git repositories in. If there are none, they
+ * are read from standard input, one per line.
+ *
+ * @return Exit code.
+ */
+int run_batch(int const argc, char const* argv[])
+{
+    if (C::git_libgit2_init() <= 0)
+    {
+        return EXIT_FAILURE;
+    }
+#ifdef _WIN32
+    bool colour = false;
+#else
+    bool colour = isatty(STDOUT_FILENO);
+#endif
+    std::mutex output_mutex;
+    ThreadPool thread_pool(std::max(1U, std::thread::hardware_concurrency()));
+    auto found = [&thread_pool, colour, &output_mutex](std::string const& directory)
+    {
+        thread_pool.submit(
+            [directory, colour, &output_mutex]
+            {
+                report_batch_repository(directory, colour, output_mutex);
+            }
+        );
+    };
+    if (argc > 0)
+    {
+        for (int i = 0; i < argc; ++i)
+        {
+            find_batch_repositories(argv[i], found);
+        }
+    }
+    else
+    {
+        std::string line;
+        while (std::getline(std::cin, line))
+        {
+            if (!line.empty())
+            {
+                find_batch_repositories(line, found);
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+#ifdef BENCHMARK
+/**
+ * Number of allocations made using `operator new` so far.
+ */
+static std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+/**
+ * Resources used by this process so far.
+ */
+struct BenchmarkCounters
+{
+    std::size_t allocations, writes;
+};
+
+/**
+ * Read the resources used by this process so far. The number of system calls
+ * which wrote something is available only on Linux; elsewhere, it is zero.
+ * Reading it does not allocate using `operator new`.
+ *
+ * @return Counters.
+ */
+BenchmarkCounters read_benchmark_counters(void)
+{
+    BenchmarkCounters counters = { allocations.load(std::memory_order_relaxed), 0 };
+    std::FILE* io_file = std::fopen("/proc/self/io", "r");
+    if (io_file == nullptr)
+    {
+        return counters;
+    }
+    char key[32];
+    std::size_t value;
+    while (std::fscanf(io_file, "%31s %zu", key, &value) == 2)
+    {
+        if (std::strcmp(key, "syscw:") == 0)
+        {
+            counters.writes = value;
+        }
+    }
+    std::fclose(io_file);
+    return counters;
+}
+
+/**
+ * Running times of one stage of the prompt, and the resources it used.
+ */
+struct BenchmarkStage
+{
+    char const* name;
+    std::vector<double> durations;
+    BenchmarkCounters counters;
+};
+
+/**
+ * Record the running time of a stage of the prompt which just completed, and
+ * the resources it used.
+ *
+ * @param stage Stage.
+ * @param lap Time at which the stage began. Updated to the current time, at
+ * which the next stage begins.
+ * @param counters Resources used before the stage began. Updated likewise.
+ */
+void record_lap(BenchmarkStage& stage, std::chrono::steady_clock::time_point& lap, BenchmarkCounters& counters)
+{
+    auto now = std::chrono::steady_clock::now();
+    stage.durations.push_back(std::chrono::duration<double, std::micro>(now - lap).count());
+    BenchmarkCounters now_counters = read_benchmark_counters();
+    stage.counters.allocations += now_counters.allocations - counters.allocations;
+    stage.counters.writes += now_counters.writes - counters.writes;
+    counters = read_benchmark_counters();
+    lap = std::chrono::steady_clock::now();
+}
+
+/**
+ * Show the running time of the first run of a stage (when caches are cold),
+ * the percentiles of the running times of all runs, and the average numbers of
+ * allocations and write system calls per run.
+ *
+ * @param stage Stage.
+ */
+void print_stage_statistics(BenchmarkStage& stage)
+{
+    double first = stage.durations.front();
+    double runs = stage.durations.size();
+    std::sort(stage.durations.begin(), stage.durations.end());
+    auto percentile = [&stage](std::size_t p)
+    {
+        // Nearest-rank method.
+        std::size_t rank = (p * stage.durations.size() + 99) / 100;
+        return stage.durations[rank > 0 ? rank - 1 : 0];
+    };
+    std::cout << std::left << std::setw(34) << stage.name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << first << std::setw(12) << percentile(50) << std::setw(12) << percentile(95)
+              << std::setw(12) << percentile(99) << std::setw(12) << stage.counters.allocations / runs
+              << std::setw(12) << stage.counters.writes / runs << '\n';
+}
+
+/**
+ * Measure the running time of each stage of the prompt in the current Git
+ * repository, and show the statistics in microseconds. Caches work as usual,
+ * so only the first run may be slow. What the prompt writes is discarded.
+ *
+ * @param argc Number of command line arguments.
+ * @param argv Command line arguments: the number of runs.
+ *
+ * @return Exit code.
+ */
+int run_benchmark(int const argc, char const* argv[])
+{
+    int iterations = argc >= 2 ? try_parse_number(argv[1], 1000) : 1000;
+    if (iterations <= 0 || C::git_libgit2_init() <= 0)
+    {
+        return EXIT_FAILURE;
+    }
+    BenchmarkStage stages[] = {
+        { "open_repository", {}, {} },
+        { "establish_description", {}, {} },
+        { "establish_tag", {}, {} },
+        { "establish_state", {}, {} },
+        { "establish_dirty_staged_untracked", {}, {} },
+        { "establish_ahead_behind", {}, {} },
+        { "establish_submodules", {}, {} },
+        { "get_information", {}, {} },
+        { "write_report", {}, {} },
+        { "render_primary_prompt", {}, {} },
+    };
+    for (BenchmarkStage& stage : stages)
+    {
+        stage.durations.reserve(iterations);
+    }
+
+    std::cout.flush();
+    int stdout_fd = dup(STDOUT_FILENO);
+    int stderr_fd = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+    Interval interval(3661.001);
+    std::string information;
+    BenchmarkCounters counters = read_benchmark_counters();
+    int i = 0;
+    for (; i < iterations; ++i)
+    {
+        auto lap = std::chrono::steady_clock::now();
+        GitRepository git_repository(current_directory(), false);
+        record_lap(stages[0], lap, counters);
+        if (git_repository.repo == nullptr)
+        {
+            break;
+        }
+        git_repository.establish_description();
+        record_lap(stages[1], lap, counters);
+        git_repository.establish_tag();
+        record_lap(stages[2], lap, counters);
+        git_repository.establish_state();
+        record_lap(stages[3], lap, counters);
+        git_repository.establish_dirty_staged_untracked();
+        record_lap(stages[4], lap, counters);
+        git_repository.establish_ahead_behind();
+        record_lap(stages[5], lap, counters);
+        git_repository.submodule_status.start(git_repository.repo);
+        git_repository.establish_submodules();
+        record_lap(stages[6], lap, counters);
+        information = git_repository.get_information();
+        record_lap(stages[7], lap, counters);
+        write_report("last_command", 0, interval, 79);
+        record_lap(stages[8], lap, counters);
+        OutputBuffer primary_prompt_buffer;
+        render_primary_prompt(primary_prompt_buffer, build_prompt_context(79, 1, information, "", 1));
+        primary_prompt_buffer.write_to(STDOUT_FILENO);
+        record_lap(stages[9], lap, counters);
+        C::git_reference_free(git_repository.ref);
+        C::git_repository_free(git_repository.repo);
+        counters = read_benchmark_counters();
+    }
+    dup2(stdout_fd, STDOUT_FILENO);
+    dup2(stderr_fd, STDERR_FILENO);
+    if (i < iterations)
+    {
+        std::cerr << "Not in a Git repository\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Git information: " << information << ESCAPE_CODE_RAW_RESET "\n";
+    std::cout << "Running times (µs) and resources used over " << iterations << " runs\n";
+    std::cout << std::left << std::setw(34) << "stage" << std::right << std::setw(12) << "first" << std::setw(12)
+              << "p50" << std::setw(12) << "p95" << std::setw(12) << "p99" << std::setw(12) << "allocations"
+              << std::setw(12) << "writes" << '\n';
+    for (BenchmarkStage& stage : stages)
+    {
+        print_stage_statistics(stage);
+    }
+    return EXIT_SUCCESS;
+}
+#endif
+
+int main(int const argc, char const* argv[])
+{
+    record_startup_main();
+
     // Repeated keyboard interrupts cause this program to crash for unclear
     // reasons. Ignore them. It isn't expected to run for long, after all.
     std::signal(SIGINT, SIG_IGN);
 
+#ifdef BENCHMARK
+    return run_benchmark(argc, argv);
+#endif
+
+    // Obtain and remember the Git information ahead of the next prompt. Run
+    // by the shell in the background when it changes directories.
+    if (argc == 2 && std::string_view(argv[1]) == "--prefetch")
+    {
+        return GitRepository().prefetch_information() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Report the Git information of many repositories, rather than showing a
+    // prompt.
+    if (argc >= 2 && std::string_view(argv[1]) == "--batch")
+    {
+        return run_batch(argc - 2, argv + 2);
+    }
+
+#ifndef _WIN32
+    // Show how long it took to get here, to measure the cost of dynamic
+    // linking.
+    if (argc == 2 && std::string_view(argv[1]) == "--startup-profile")
+    {
+        print_startup_profile();
+        return EXIT_SUCCESS;
+    }
+
+    // Send the desktop notifications queued by prompts. Started by the prompt
+    // itself; not meant to be run by hand.
+    if (argc == 2 && std::string_view(argv[1]) == "--notify")
+    {
+        return run_notification_helper();
+    }
+
+    // Stay alive and serve prompts to clients, so that libgit2 need not be
+    // initialised and Git repositories need not be opened for every prompt.
+    if (argc == 2 && std::string_view(argv[1]) == "--server")
+    {
+#if defined BASH
+        std::string socket_path = prompt_socket_path("custom-bash-prompt");
+#elif defined ZSH
+        std::string socket_path = prompt_socket_path("custom-zsh-prompt");
+#endif
+        if (C::git_libgit2_init() <= 0)
+        {
+            return EXIT_FAILURE;
+        }
+        PromptServerHooks hooks = {
+            main_internal, prepare_repository, StatusWatcher::get_all_fds, StatusWatcher::dispatch_events
+        };
+        return run_prompt_server(socket_path, hooks);
+    }
+#endif
+
     // For testing. Simulate dummy arguments so that the longer code path is
     // taken. Honour the standard requirement that the argument list be
     // null-terminated.
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "dirty_detector.hh"
+#include "git_status.hh"
+#include "index_file.hh"
+#include "json_logger.hh"
+#include "stat_gatherer.hh"
+#include "trace_span.hh"
+
+static JSONLogger logger;
+
+#ifdef __APPLE__
+#define ST_MTIM st_mtimespec
+#else
+#define ST_MTIM st_mtim
+#endif
+
+// File modes as recorded in the index.
+static std::uint32_t constexpr MODE_TYPE_MASK = 0170000;
+static std::uint32_t constexpr MODE_REGULAR = 0100644;
+static std::uint32_t constexpr MODE_EXECUTABLE = 0100755;
+static std::uint32_t constexpr MODE_SYMLINK = 0120000;
+static std::uint32_t constexpr MODE_GITLINK = 0160000;
+
+static std::uint16_t constexpr STAGE_MASK = 0x3000;
+static std::uint16_t constexpr EXTENDED_SKIP_WORKTREE = 0x4000;
+static std::uint16_t constexpr EXTENDED_INTENT_TO_ADD = 0x2000;
+
+/**
+ * Prepare to examine the tracked files of the given Git repository. Which
+ * fields of the stat data are compared depends on `core.trustCtime`,
+ * `core.fileMode` and `core.checkStat`.
+ *
+ * @param repo Git repository.
+ * @param index_file Index of the repository.
+ */
+DirtyDetector::DirtyDetector(C::git_repository* repo, IndexFile const& index_file) :
+    repo(repo), index_file(index_file), trust_ctime(true), trust_mode(true), check_all_stat(true),
+    index_mtime_seconds(0), index_mtime_nanoseconds(0)
+{
+    char const* workdir = C::git_repository_workdir(repo);
+    C::git_config* config;
+    if (workdir == nullptr || C::git_repository_config_snapshot(&config, repo) != 0)
+    {
+        return;
+    }
+    this->workdir = workdir;
+    int value;
+    if (C::git_config_get_bool(&value, config, "core.trustCtime") == 0)
+    {
+        this->trust_ctime = value;
+    }
+    if (C::git_config_get_bool(&value, config, "core.fileMode") == 0)
+    {
+        this->trust_mode = value;
+    }
+    char const* check_stat;
+    if (C::git_config_get_string(&check_stat, config, "core.checkStat") == 0)
+    {
+        this->check_all_stat = std::string_view(check_stat) != "minimal";
+    }
+    C::git_config_free(config);
+
+#ifndef _WIN32
+    // Files modified in the same instant as the index was written may have
+    // been modified after their stat data were recorded.
+    std::string index_path = (std::filesystem::path(C::git_repository_path(repo)) / "index").string();
+    struct stat index_stat;
+    if (stat(index_path.data(), &index_stat) == 0)
+    {
+        this->index_mtime_seconds = index_stat.ST_MTIM.tv_sec;
+        this->index_mtime_nanoseconds = index_stat.ST_MTIM.tv_nsec;
+    }
+#endif
+}
+
+/**
+ * Count the modified files.
+ *
+ * @param counts Counts to update.
+ *
+ * @return Whether the modified files were counted.
+ */
+bool DirtyDetector::count(StatusCounts& counts)
+{
+#ifdef _WIN32
+    return false;
+#else
+    TraceSpan trace_span(__func__);
+    if (this->workdir.empty())
+    {
+        return false;
+    }
+    StatBatch batch;
+    std::size_t entrycount = this->index_file.entrycount();
+    for (std::size_t chunk = 0; chunk < entrycount; chunk += CHUNK_SIZE)
+    {
+        std::size_t chunk_size = std::min(CHUNK_SIZE, entrycount - chunk);
+        this->stat_files(chunk, chunk_size);
+        for (std::size_t begin = chunk; begin < chunk + chunk_size; begin += StatBatch::SIZE)
+        {
+            std::size_t batch_size = std::min(StatBatch::SIZE, chunk + chunk_size - begin);
+            this->gather(begin, batch_size, this->file_stats.data() + (begin - chunk), batch);
+            std::uint64_t mismatches = this->compare(begin, batch_size, batch);
+            for (std::size_t k = 0; k < batch_size; ++k)
+            {
+                std::size_t i = begin + k;
+                if (!this->is_examined(i) || (!(mismatches >> k & 1) && !this->is_racy(i))
+                    || !this->is_modified(i, batch, k))
+                {
+                    continue;
+                }
+                if (counts.dirty <= counts.limits.dirty)
+                {
+                    LOG_DEBUG(
+                        logger, "Found file in repository", "path", this->index_file.paths[i], "status", "dirty"
+                    );
+                    ++counts.dirty;
+                }
+            }
+        }
+    }
+    return true;
+#endif
+}
+
+/**
+ * Check whether an entry of the index is examined. Conflicts, submodules and
+ * entries not expected in the working tree are not.
+ *
+ * @param i Entry number.
+ *
+ * @return Whether the entry is examined.
+ */
+bool DirtyDetector::is_examined(std::size_t i) const
+{
+    return (this->index_file.flags[i] & STAGE_MASK) == 0
+        && (this->index_file.extended_flags[i] & (EXTENDED_SKIP_WORKTREE | EXTENDED_INTENT_TO_ADD)) == 0
+        && (this->index_file.modes[i] & MODE_TYPE_MASK) != MODE_GITLINK;
+}
+
+/**
+ * Obtain the stat data of the files of a chunk of entries (those which are
+ * examined), all at once.
+ *
+ * @param begin First entry number.
+ * @param chunk_size Number of entries.
+ */
+void DirtyDetector::stat_files(std::size_t begin, std::size_t chunk_size)
+{
+    // Paths are pointed to only once they are all in the buffer, which might
+    // move while growing.
+    this->path_buffer.clear();
+    this->file_paths.assign(chunk_size, nullptr);
+    std::vector<std::size_t> path_offsets(chunk_size);
+    for (std::size_t k = 0, i = begin; k < chunk_size; ++k, ++i)
+    {
+        if (this->is_examined(i))
+        {
+            path_offsets[k] = this->path_buffer.size();
+            this->path_buffer += this->workdir;
+            this->path_buffer += this->index_file.paths[i];
+            this->path_buffer += '\0';
+        }
+    }
+    for (std::size_t k = 0, i = begin; k < chunk_size; ++k, ++i)
+    {
+        if (this->is_examined(i))
+        {
+            this->file_paths[k] = this->path_buffer.data() + path_offsets[k];
+        }
+    }
+    this->stat_gatherer.gather(this->file_paths, this->file_stats);
+}
+
+/**
+ * Fill in the stat data of a batch of entries from those of their files.
+ * Fields which are not to be compared are copied from the index instead, as is
+ * everything for entries which are not examined. Missing files get a mode of
+ * 0.
+ *
+ * @param begin First entry number.
+ * @param batch_size Number of entries.
+ * @param file_stats Stat data of the files of the entries.
+ * @param batch Stat data to fill in.
+ */
+void DirtyDetector::gather(
+    std::size_t begin, std::size_t batch_size, FileStat const* file_stats, StatBatch& batch
+) const
+{
+#ifndef _WIN32
+    IndexFile const& index_file = this->index_file;
+    for (std::size_t k = 0, i = begin; k < batch_size; ++k, ++i)
+    {
+        FileStat const& file_stat = file_stats[k];
+        bool examined = this->is_examined(i);
+        if (!examined || file_stat.mode == 0)
+        {
+            batch.ctime_seconds[k] = index_file.ctime_seconds[i];
+            batch.ctime_nanoseconds[k] = index_file.ctime_nanoseconds[i];
+            batch.mtime_seconds[k] = index_file.mtime_seconds[i];
+            batch.mtime_nanoseconds[k] = index_file.mtime_nanoseconds[i];
+            batch.inos[k] = index_file.inos[i];
+            batch.modes[k] = examined ? 0 : index_file.modes[i];
+            batch.uids[k] = index_file.uids[i];
+            batch.gids[k] = index_file.gids[i];
+            batch.file_sizes[k] = index_file.file_sizes[i];
+            continue;
+        }
+        // Like Git, truncate everything to 32 bits.
+        bool check_ctime = this->check_all_stat && this->trust_ctime;
+        batch.ctime_seconds[k] = check_ctime ? file_stat.ctime_seconds : index_file.ctime_seconds[i];
+        batch.ctime_nanoseconds[k] = check_ctime ? file_stat.ctime_nanoseconds : index_file.ctime_nanoseconds[i];
+        batch.mtime_seconds[k] = file_stat.mtime_seconds;
+        batch.mtime_nanoseconds[k]
+            = this->check_all_stat ? file_stat.mtime_nanoseconds : index_file.mtime_nanoseconds[i];
+        batch.inos[k] = this->check_all_stat ? file_stat.ino : index_file.inos[i];
+        batch.uids[k] = this->check_all_stat ? file_stat.uid : index_file.uids[i];
+        batch.gids[k] = this->check_all_stat ? file_stat.gid : index_file.gids[i];
+        batch.file_sizes[k] = file_stat.size;
+        if (S_ISLNK(file_stat.mode))
+        {
+            batch.modes[k] = MODE_SYMLINK;
+        }
+        else if (!S_ISREG(file_stat.mode))
+        {
+            batch.modes[k] = file_stat.mode & MODE_TYPE_MASK;
+        }
+        else if (!this->trust_mode && (index_file.modes[i] & MODE_TYPE_MASK) == (MODE_REGULAR & MODE_TYPE_MASK))
+        {
+            batch.modes[k] = index_file.modes[i];
+        }
+        else
+        {
+            batch.modes[k] = file_stat.mode & S_IXUSR ? MODE_EXECUTABLE : MODE_REGULAR;
+        }
+    }
+#endif
+}
+
+/**
+ * Compare the stat data of a batch of entries with those recorded in the
+ * index, four entries at a time if SSE2 is available.
+ *
+ * @param begin First entry number.
+ * @param batch_size Number of entries.
+ * @param batch Stat data.
+ *
+ * @return Bit mask of the entries whose stat data differ, the least
+ * significant bit corresponding to the first entry.
+ */
+std::uint64_t DirtyDetector::compare(std::size_t begin, std::size_t batch_size, StatBatch const& batch) const
+{
+    IndexFile const& index_file = this->index_file;
+    std::uint32_t const* index_fields[]
+        = { index_file.ctime_seconds.data(), index_file.ctime_nanoseconds.data(), index_file.mtime_seconds.data(),
+            index_file.mtime_nanoseconds.data(), index_file.inos.data(), index_file.modes.data(),
+            index_file.uids.data(), index_file.gids.data(), index_file.file_sizes.data() };
+    std::uint32_t const* batch_fields[]
+        = { batch.ctime_seconds, batch.ctime_nanoseconds, batch.mtime_seconds, batch.mtime_nanoseconds, batch.inos,
+            batch.modes, batch.uids, batch.gids, batch.file_sizes };
+    std::uint64_t mismatches = 0;
+    std::size_t k = 0;
+#ifdef __SSE2__
+    for (; k + 4 <= batch_size; k += 4)
+    {
+        __m128i equal = _mm_set1_epi32(-1);
+        for (std::size_t field = 0; field < sizeof index_fields / sizeof *index_fields; ++field)
+        {
+            __m128i index_values = _mm_loadu_si128(reinterpret_cast<__m128i const*>(index_fields[field] + begin + k));
+            __m128i batch_values = _mm_loadu_si128(reinterpret_cast<__m128i const*>(batch_fields[field] + k));
+            equal = _mm_and_si128(equal, _mm_cmpeq_epi32(index_values, batch_values));
+        }
+        std::uint64_t equal_mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+        mismatches |= (~equal_mask & 0xF) << k;
+    }
+#endif
+    for (; k < batch_size; ++k)
+    {
+        bool equal = true;
+        for (std::size_t field = 0; field < sizeof index_fields / sizeof *index_fields; ++field)
+        {
+            equal = equal && index_fields[field][begin + k] == batch_fields[field][k];
+        }
+        mismatches |= static_cast<std::uint64_t>(!equal) << k;
+    }
+    return mismatches;
+}
+
+/**
+ * Check whether the stat data of an entry of the index cannot be trusted,
+ * because the file was modified no earlier than the index was written.
+ *
+ * @param i Entry number.
+ *
+ * @return Whether the entry is racily clean.
+ */
+bool DirtyDetector::is_racy(std::size_t i) const
+{
+    std::int64_t mtime_seconds = this->index_file.mtime_seconds[i];
+    return mtime_seconds > this->index_mtime_seconds
+        || (mtime_seconds == this->index_mtime_seconds
+            && this->index_file.mtime_nanoseconds[i] >= this->index_mtime_nanoseconds);
+}
+
+/**
+ * Check whether the file of an entry of the index, whose stat data differ from
+ * those recorded (or cannot be trusted), is modified. If its type, mode and
+ * size are unchanged, its contents are hashed.
+ *
+ * @param i Entry number.
+ * @param batch Stat data.
+ * @param k Position of the entry in the batch.
+ *
+ * @return Whether the file is modified.
+ */
+bool DirtyDetector::is_modified(std::size_t i, StatBatch const& batch, std::size_t k) const
+{
+#ifdef _WIN32
+    return true;
+#else
+    std::uint32_t mode = batch.modes[k];
+    std::uint32_t file_size = this->index_file.file_sizes[i];
+    if (mode == 0 || mode != this->index_file.modes[i] || (batch.file_sizes[k] != file_size && file_size != 0))
+    {
+        return true;
+    }
+    std::string entry_path(this->index_file.paths[i]);
+    C::git_oid oid;
+    if (mode == MODE_SYMLINK)
+    {
+        std::string file_path = this->workdir + entry_path;
+        char target[4096];
+        ssize_t target_size = readlink(file_path.data(), target, sizeof target / sizeof *target);
+        if (target_size < 0 || C::git_odb_hash(&oid, target, target_size, C::GIT_OBJECT_BLOB) != 0)
+        {
+            return true;
+        }
+    }
+    else if (C::git_repository_hashfile(&oid, this->repo, entry_path.data(), C::GIT_OBJECT_BLOB, entry_path.data())
+             != 0)
+    {
+        return true;
+    }
+    return std::memcmp(oid.id, this->index_file.oids[i], sizeof oid.id) != 0;
+#endif
+}
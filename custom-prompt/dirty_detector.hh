@@ -0,0 +1,62 @@
+#ifndef DIRTY_DETECTOR_HH_
+#define DIRTY_DETECTOR_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "git_status.hh"
+#include "index_file.hh"
+#include "libgit2.hh"
+#include "stat_gatherer.hh"
+
+/**
+ * Stat data of a batch of files, laid out like the stat data in `IndexFile`,
+ * so that the two can be compared a field at a time for several files at
+ * once.
+ */
+struct StatBatch
+{
+    static std::size_t constexpr SIZE = 64;
+    std::uint32_t ctime_seconds[SIZE], ctime_nanoseconds[SIZE], mtime_seconds[SIZE], mtime_nanoseconds[SIZE];
+    std::uint32_t inos[SIZE], modes[SIZE], uids[SIZE], gids[SIZE], file_sizes[SIZE];
+};
+
+/**
+ * Count the tracked files in the working tree of a Git repository which are
+ * modified, by comparing their stat data with that recorded in the index, as
+ * Git does. Only files whose stat data differ (or which were modified too
+ * close to when the index was written for their stat data to be trusted) are
+ * examined further.
+ */
+class DirtyDetector
+{
+private:
+    // Files whose stat data are requested at a time: enough to keep an
+    // io_uring instance full for a while.
+    static std::size_t constexpr CHUNK_SIZE = 4096;
+    C::git_repository* repo;
+    IndexFile const& index_file;
+    std::string workdir;
+    bool trust_ctime, trust_mode, check_all_stat;
+    std::int64_t index_mtime_seconds, index_mtime_nanoseconds;
+    StatGatherer stat_gatherer;
+    std::string path_buffer;
+    std::vector<char const*> file_paths;
+    std::vector<FileStat> file_stats;
+
+public:
+    DirtyDetector(C::git_repository*, IndexFile const&);
+    bool count(StatusCounts&);
+
+private:
+    bool is_examined(std::size_t) const;
+    void stat_files(std::size_t, std::size_t);
+    void gather(std::size_t, std::size_t, FileStat const*, StatBatch&) const;
+    std::uint64_t compare(std::size_t, std::size_t, StatBatch const&) const;
+    bool is_racy(std::size_t) const;
+    bool is_modified(std::size_t, StatBatch const&, std::size_t) const;
+};
+
+#endif
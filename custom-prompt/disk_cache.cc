@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#include "disk_cache.hh"
+#include "json_logger.hh"
+
+static JSONLogger logger;
+
+/**
+ * Obtain the path of a cache file. The directory containing it is created if
+ * it does not exist.
+ *
+ * @param kind What is cached. Used as the file name prefix.
+ * @param key What the cached data pertains to (e.g. a repository path).
+ *
+ * @return Cache file path, or an empty path if there is no cache directory.
+ */
+std::filesystem::path cache_file_path(std::string_view kind, std::string_view key)
+{
+    std::filesystem::path cache_directory;
+    char const* cache_home = std::getenv("XDG_CACHE_HOME");
+    char const* home = std::getenv("HOME");
+    if (cache_home != nullptr && cache_home[0] != '\0')
+    {
+        cache_directory = cache_home;
+    }
+    else if (home != nullptr && home[0] != '\0')
+    {
+        cache_directory = std::filesystem::path(home) / ".cache";
+    }
+    else
+    {
+        return {};
+    }
+    cache_directory /= "custom-prompt";
+    std::error_code ec;
+    std::filesystem::create_directories(cache_directory, ec);
+
+    // FNV-1a. Collisions are harmless, because cache files record what they
+    // pertain to, and are validated before use.
+    std::uint64_t hash = 0xCBF29CE484222325U;
+    for (char c : key)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3U;
+    }
+    char hash_buf[17];
+    std::snprintf(hash_buf, sizeof hash_buf / sizeof *hash_buf, "%016llx", static_cast<long long unsigned>(hash));
+    return cache_directory / (std::string(kind) + '-' + hash_buf);
+}
+
+/**
+ * Obtain the modification time of a file in an unspecified unit. This is
+ * meant only to check whether a file has changed.
+ *
+ * @param path File path.
+ *
+ * @return Modification time, or -1 if it is not available.
+ */
+std::int64_t modification_time(std::filesystem::path const& path)
+{
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    if (ec)
+    {
+        return -1;
+    }
+    return mtime.time_since_epoch().count();
+}
+
+/**
+ * Replace the contents of a file atomically, so that concurrent readers see
+ * either the old contents or the new contents, never a mix.
+ *
+ * @param path File path.
+ * @param contents New contents.
+ *
+ * @return Whether the contents were replaced.
+ */
+bool replace_file_contents(std::filesystem::path const& path, std::string const& contents)
+{
+    // The temporary file must not be shared with concurrent writers.
+    std::size_t writer_id = std::hash<std::thread::id>()(std::this_thread::get_id())
+        ^ std::chrono::steady_clock::now().time_since_epoch().count();
+    std::filesystem::path temporary_path = path;
+    temporary_path += ".tmp" + std::to_string(writer_id);
+    {
+        std::ofstream temporary_file(temporary_path, std::ios::binary | std::ios::trunc);
+        if (!temporary_file.write(contents.data(), contents.size()) || !temporary_file.flush())
+        {
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temporary_path, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(temporary_path, ec);
+        return false;
+    }
+    LOG_DEBUG(logger, "Wrote cache file", "path", path.string(), "bytes", contents.size());
+    return true;
+}
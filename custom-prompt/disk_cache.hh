@@ -0,0 +1,13 @@
+#ifndef DISK_CACHE_HH_
+#define DISK_CACHE_HH_
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+std::filesystem::path cache_file_path(std::string_view, std::string_view);
+std::int64_t modification_time(std::filesystem::path const&);
+bool replace_file_contents(std::filesystem::path const&, std::string const&);
+
+#endif
@@ -1,5 +1,9 @@
+#include <chrono>
+#include <cstddef>
+
 #include "focus_utils.hh"
 #include "json_logger.hh"
+#include "trace_span.hh"
 
 static JSONLogger logger;
 
@@ -8,12 +12,25 @@ static JSONLogger logger;
 #include <tchar.h>
 #include <windows.h>
 
-bool terminal_has_focus(void)
+FocusProbe::FocusProbe(void)
+{
+}
+
+FocusProbe::~FocusProbe()
+{
+}
+
+void FocusProbe::start(void)
 {
+}
+
+bool FocusProbe::has_focus(std::chrono::steady_clock::time_point deadline)
+{
+    TraceSpan trace_span(__func__);
     HWND foreground_window = GetForegroundWindow();
     TCHAR class_name[64];
     int class_name_len = GetClassName(foreground_window, class_name, sizeof class_name / sizeof *class_name);
-    LOG_DEBUG(logger, "Read active window", { { "class_name_len", class_name_len } });
+    LOG_DEBUG(logger, "Read active window", "class_name_len", class_name_len);
     if (class_name_len == 0)
     {
         return false;
@@ -24,123 +41,133 @@ bool terminal_has_focus(void)
     return _tcscmp(class_name, _T("org.wezfurlong.wezterm")) == 0;
 }
 
+void FocusProbe::stop(void)
+{
+}
+
 #else
 
-#include <iostream>
 #include <string_view>
 
+#include <poll.h>
 #include <stddef.h>
 #include <termios.h>
 #include <unistd.h>
 
+static char const FOCUS_REPORTING_ENABLE[] = "\x1b\x5b?1004h";
+static char const FOCUS_REPORTING_DISABLE[] = "\x1b\x5b?1004l";
+static char const FOCUS_IN[] = "\x1b\x5bI";
+static char const FOCUS_OUT[] = "\x1b\x5bO";
+
 /**
- * Temporarily modify standard input to allow non-blocking reads.
+ * Prepare a probe which has not started.
  */
-class NonBlockingStandardInputGuard
+FocusProbe::FocusProbe(void) : started(false)
 {
-private:
-    bool m_error_occurred;
-    termios prev_termios, curr_termios;
+}
 
-public:
-    NonBlockingStandardInputGuard(void);
-    bool error_occurred(void) const;
-    ~NonBlockingStandardInputGuard();
-};
+/**
+ * Stop the probe if its answer was never awaited.
+ */
+FocusProbe::~FocusProbe()
+{
+    this->stop();
+}
 
 /**
- * Enable non-canonical mode.
+ * Ask the terminal to report whether it has focus, without waiting for the
+ * answer. Standard input is put in non-canonical mode (so that the answer can
+ * be read as soon as it arrives) until the answer is awaited.
  */
-NonBlockingStandardInputGuard::NonBlockingStandardInputGuard(void) : m_error_occurred(false)
+void FocusProbe::start(void)
 {
+    TraceSpan trace_span(__func__);
     if (tcgetattr(STDIN_FILENO, &this->prev_termios) == -1)
     {
-        this->m_error_occurred = true;
         return;
     }
-    this->curr_termios = this->prev_termios;
-    this->curr_termios.c_lflag &= ~(ECHO | ICANON);
-    // Set a timeout on standard input reads.
-    this->curr_termios.c_cc[VMIN] = 0;
-    this->curr_termios.c_cc[VTIME] = 1;
-    if (tcsetattr(STDIN_FILENO, TCSANOW, &this->curr_termios) == -1)
+    termios curr_termios = this->prev_termios;
+    curr_termios.c_lflag &= ~(ECHO | ICANON);
+    // Make standard input reads return immediately.
+    curr_termios.c_cc[VMIN] = 0;
+    curr_termios.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &curr_termios) == -1)
     {
-        this->m_error_occurred = true;
+        return;
     }
-}
+    this->started = true;
 
-/**
- * Check whether an error occurred while trying to get or set terminal
- * attributes.
- *
- * @return Error indicator.
- */
-bool NonBlockingStandardInputGuard::error_occurred(void) const
-{
-    return this->m_error_occurred;
+    // Consume standard input so that anything entered previously is removed
+    // and it is ready to receive focus escape sequences. There is a small
+    // chance that the user types something after standard input is consumed
+    // but before the terminal sends the sequences. This rare failure is
+    // acceptable.
+    char buf[1024];
+    ssize_t count;
+    while ((count = read(STDIN_FILENO, buf, sizeof buf / sizeof *buf)) > 0)
+    {
+        LOG_DEBUG(logger, "Cleared standard input", "count", count);
+    }
+    if (count < 0 || write(STDERR_FILENO, FOCUS_REPORTING_ENABLE, sizeof FOCUS_REPORTING_ENABLE - 1) < 0)
+    {
+        this->stop();
+        return;
+    }
 }
 
 /**
- * Disable non-canonical mode.
+ * Wait for the answer of the terminal, and stop the probe. The answer is
+ * awaited until the given deadline, which a slow connection to the terminal
+ * may need all of.
+ *
+ * @param deadline Time after which the answer is not awaited.
+ *
+ * @return Focus state. If the terminal did not answer, it is assumed not to
+ * have focus.
  */
-NonBlockingStandardInputGuard::~NonBlockingStandardInputGuard()
+bool FocusProbe::has_focus(std::chrono::steady_clock::time_point deadline)
 {
-    if (!this->m_error_occurred)
+    TraceSpan trace_span(__func__);
+    if (!this->started)
     {
-        tcsetattr(STDIN_FILENO, TCSANOW, &this->prev_termios);
+        return false;
     }
-}
-
-bool terminal_has_focus(void)
-{
     char buf[1024];
-    ssize_t count;
+    std::size_t size = 0;
+    std::string_view buf_view;
+    while (size < sizeof buf / sizeof *buf && buf_view.find(FOCUS_IN) == std::string_view::npos
+           && buf_view.find(FOCUS_OUT) == std::string_view::npos)
     {
-        NonBlockingStandardInputGuard guard;
-        if (guard.error_occurred())
-        {
-            return false;
-        }
-
-        // Consume standard input so that anything entered previously is
-        // removed and it is ready to receive focus escape sequences. There is
-        // a small chance that the user types something after standard input is
-        // consumed but before the terminal sends the sequences. This rare
-        // failure is acceptable.
-        while ((count = read(STDIN_FILENO, buf, sizeof buf / sizeof *buf)) > 0)
+        // Round up, so as not to spin when less than a millisecond is left.
+        auto timeout = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd stdin_pollfd = { STDIN_FILENO, POLLIN, 0 };
+        if (timeout.count() <= 0 || poll(&stdin_pollfd, 1, timeout.count()) <= 0)
         {
-            LOG_DEBUG(logger, "Cleared standard input", { { "count", count } });
+            break;
         }
-        if (count < 0)
+        ssize_t count = read(STDIN_FILENO, buf + size, sizeof buf / sizeof *buf - size);
+        if (count <= 0)
         {
-            return false;
+            break;
         }
-
-        // Enable focus reporting.
-        std::clog << "\x1b\x5b?1004h";
-        count = read(STDIN_FILENO, buf, sizeof buf / sizeof *buf);
-
-        // Disable focus reporting. If it is disabled immediately after
-        // enabling it instead of here, the terminal may never send any focus
-        // escape sequences. There is a small chance that more sequences get
-        // written to standard input before focus reporting gets disabled but
-        // after the previous sequences have been read. This rare failure is
-        // acceptable.
-        std::clog << "\x1b\x5b?1004l";
+        size += count;
+        buf_view = std::string_view(buf, size);
     }
 
-    LOG_DEBUG(logger, "Read non-blocking standard input", { { "count", count } });
-    if (count <= 0)
-    {
-        return false;
-    }
-    std::string_view buf_view(buf, count);
-    size_t focus_out_seq_pos = buf_view.rfind("\x1b\x5bO");
+    // Disable focus reporting. If it is disabled immediately after enabling
+    // it instead of here, the terminal may never send any focus escape
+    // sequences. There is a small chance that more sequences get written to
+    // standard input before focus reporting gets disabled but after the
+    // previous sequences have been read. This rare failure is acceptable.
+    this->stop();
+
+    LOG_DEBUG(logger, "Read focus report", "size", size);
+    std::size_t focus_out_seq_pos = buf_view.rfind(FOCUS_OUT);
     if (focus_out_seq_pos == std::string_view::npos)
     {
-        return true;
+        return size > 0;
     }
-    size_t focus_in_seq_pos = buf_view.rfind("\x1b\x5bI");
+    std::size_t focus_in_seq_pos = buf_view.rfind(FOCUS_IN);
     if (focus_in_seq_pos == std::string_view::npos)
     {
         return false;
@@ -148,4 +175,19 @@ bool terminal_has_focus(void)
     return focus_out_seq_pos < focus_in_seq_pos;
 }
 
+/**
+ * Disable focus reporting and restore standard input, if the probe was
+ * started.
+ */
+void FocusProbe::stop(void)
+{
+    if (!this->started)
+    {
+        return;
+    }
+    this->started = false;
+    write(STDERR_FILENO, FOCUS_REPORTING_DISABLE, sizeof FOCUS_REPORTING_DISABLE - 1);
+    tcsetattr(STDIN_FILENO, TCSANOW, &this->prev_termios);
+}
+
 #endif
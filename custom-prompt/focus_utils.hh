@@ -1,11 +1,33 @@
 #ifndef FOCUS_UTILS_HH_
 #define FOCUS_UTILS_HH_
 
+#include <chrono>
+
+#ifndef _WIN32
+#include <termios.h>
+#endif
+
 /**
- * Check whether the terminal has GUI focus.
- *
- * @return Focus state.
+ * Check whether the terminal has GUI focus. On Linux and macOS, the terminal
+ * is asked to report it, and the answer is awaited only when needed, so that
+ * other work can be done in the meantime.
  */
-bool terminal_has_focus(void);
+class FocusProbe
+{
+private:
+#ifndef _WIN32
+    bool started;
+    termios prev_termios;
+#endif
+
+public:
+    FocusProbe(void);
+    ~FocusProbe();
+    void start(void);
+    bool has_focus(std::chrono::steady_clock::time_point);
+
+private:
+    void stop(void);
+};
 
 #endif
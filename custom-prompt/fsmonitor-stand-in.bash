@@ -0,0 +1,25 @@
+#! /usr/bin/env bash
+
+# Stand-in for a file system monitor, speaking version 2 of the fsmonitor hook
+# protocol, for testing and benchmarking. Instead of watching the working tree,
+# it walks it looking for paths modified after the time given in the token, so
+# it is correct but not fast. Set it up with:
+#
+#     git config core.fsmonitor /path/to/fsmonitor-stand-in.bash
+#     git config core.fsmonitorHookVersion 2
+
+[ $# -eq 2 ] && [ "$1" = 2 ] || exit 1
+token=$2
+
+# Take the new token before walking, so that paths modified while walking are
+# reported again the next time.
+printf '%s\0' $(date +%s.%N)
+if [[ $token =~ ^[0-9]+\.[0-9]+$ ]] && [ -z "$(find . -maxdepth 0 -newermt @$token)" ]
+then
+    find . -mindepth 1 -path ./.git -prune -o -newermt @$token -printf '%P\0'
+else
+    # Unknown token, or entries were added to or removed from the top-level
+    # directory, which has no path of its own to report. Everything may have
+    # changed.
+    printf '/\0'
+fi
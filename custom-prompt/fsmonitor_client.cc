@@ -0,0 +1,287 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "disk_cache.hh"
+#include "fsmonitor_client.hh"
+#include "json_logger.hh"
+#include "status_ledger.hh"
+#include "trace_span.hh"
+
+static JSONLogger logger;
+
+static char const FSMONITOR_CACHE_MAGIC[] = "custom-prompt-fsmonitor 1";
+
+/**
+ * Prepare to query the file system monitor configured for the given Git
+ * repository, if any. Only hooks are supported, not Git's built-in monitor.
+ *
+ * The remembered statuses are considered valid only if HEAD, the index and the
+ * exclude file are unchanged, because changes to them affect the statuses of
+ * files without changing the files.
+ *
+ * @param repo Git repository.
+ * @param oid Object ID of the current commit, if any.
+ */
+FsmonitorClient::FsmonitorClient(C::git_repository* repo, C::git_oid const* oid) : repo(repo)
+{
+    char const* workdir = C::git_repository_workdir(repo);
+    C::git_config* config;
+    if (workdir == nullptr || C::git_repository_config_snapshot(&config, repo) != 0)
+    {
+        return;
+    }
+    char const* hook;
+    int is_enabled;
+    std::int32_t hook_version;
+    if (C::git_config_get_string(&hook, config, "core.fsmonitor") == 0 && *hook != '\0'
+        && C::git_config_parse_bool(&is_enabled, hook) != 0
+        && (C::git_config_get_int32(&hook_version, config, "core.fsmonitorHookVersion") != 0 || hook_version == 2))
+    {
+        this->hook = hook;
+    }
+    C::git_config_free(config);
+    if (this->hook.empty())
+    {
+        return;
+    }
+    this->workdir = workdir;
+    std::filesystem::path gitdir = C::git_repository_path(repo);
+    std::filesystem::path commondir = C::git_repository_commondir(repo);
+    std::error_code ec;
+    std::ostringstream fingerprint_stream;
+    fingerprint_stream << gitdir.string() << ' ' << (oid == nullptr ? "none" : C::git_oid_tostr_s(oid));
+    fingerprint_stream << ' ' << modification_time(gitdir / "index") << ' '
+                       << std::filesystem::file_size(gitdir / "index", ec);
+    fingerprint_stream << ' ' << modification_time(gitdir / "HEAD") << ' '
+                       << modification_time(commondir / "info/exclude");
+    this->fingerprint = fingerprint_stream.str();
+    this->path = cache_file_path("fsmonitor", gitdir.string());
+}
+
+/**
+ * Count the files which are modified, staged or untracked. If the statuses
+ * from the previous prompt are available, only the paths the monitor reports
+ * as changed are examined; otherwise, everything is.
+ *
+ * @param dirty Number of modified files.
+ * @param staged Number of staged files.
+ * @param untracked Number of untracked files.
+ *
+ * @return Whether the counts were obtained. If not, the arguments are not
+ * modified.
+ */
+bool FsmonitorClient::get_counts(unsigned& dirty, unsigned& staged, unsigned& untracked)
+{
+    TraceSpan trace_span(__func__);
+    if (this->hook.empty() || this->path.empty())
+    {
+        return false;
+    }
+    StatusLedger ledger(this->repo);
+    std::string token;
+    bool loaded = this->load(token, ledger);
+
+    // Query the monitor before scanning, so that changes made while scanning
+    // are reported the next time.
+    std::string new_token;
+    std::vector<std::string> changed_paths;
+    bool trivial;
+    if (!this->query(token, new_token, changed_paths, trivial))
+    {
+        return false;
+    }
+    if (!(loaded && !trivial ? ledger.rescan(changed_paths) : ledger.rescan()))
+    {
+        return false;
+    }
+    this->store(new_token, ledger);
+    dirty = ledger.dirty;
+    staged = ledger.staged;
+    untracked = ledger.untracked;
+    return true;
+}
+
+/**
+ * Read the token and the statuses remembered from the previous prompt.
+ *
+ * @param token Token to fill in.
+ * @param ledger Ledger to record the statuses in.
+ *
+ * @return Whether valid statuses were found.
+ */
+bool FsmonitorClient::load(std::string& token, StatusLedger& ledger) const
+{
+    std::ifstream cache_file(this->path);
+    std::string magic, fingerprint;
+    if (!std::getline(cache_file, magic) || magic != FSMONITOR_CACHE_MAGIC || !std::getline(cache_file, fingerprint)
+        || fingerprint != this->fingerprint || !std::getline(cache_file, token))
+    {
+        LOG_DEBUG(logger, "No valid fsmonitor state", "path", this->path.string());
+        return false;
+    }
+    unsigned status_flags;
+    std::string file_path;
+    while (cache_file >> status_flags && cache_file.get() == ' ' && std::getline(cache_file, file_path))
+    {
+        ledger.restore(file_path.data(), status_flags);
+    }
+    return cache_file.eof();
+}
+
+/**
+ * Remember the token and the statuses for the next prompt.
+ *
+ * @param token Token.
+ * @param ledger Ledger containing the statuses.
+ */
+void FsmonitorClient::store(std::string const& token, StatusLedger const& ledger) const
+{
+    if (token.find('\n') != std::string::npos)
+    {
+        return;
+    }
+    std::ostringstream cache_stream;
+    cache_stream << FSMONITOR_CACHE_MAGIC << '\n' << this->fingerprint << '\n' << token << '\n';
+    for (auto const& [file_path, status_flags] : ledger.get_statuses())
+    {
+        if (file_path.find('\n') != std::string::npos)
+        {
+            // Cannot be remembered. Make sure everything is examined next time.
+            return;
+        }
+        cache_stream << status_flags << ' ' << file_path << '\n';
+    }
+    replace_file_contents(this->path, cache_stream.str());
+}
+
+/**
+ * Run the hook to find the paths which changed since the given token. The hook
+ * is run in the working tree using the shell, as Git does.
+ *
+ * @param token Token returned by the previous query (or an empty string).
+ * @param new_token Token to fill in, identifying this query.
+ * @param changed_paths Paths to fill in, relative to the working tree.
+ * @param trivial Set to whether the monitor could not tell what changed, or
+ * something changed which may affect the statuses of any file.
+ *
+ * @return Whether the hook succeeded.
+ */
+bool FsmonitorClient::query(
+    std::string const& token, std::string& new_token, std::vector<std::string>& changed_paths, bool& trivial
+) const
+{
+#ifdef _WIN32
+    return false;
+#else
+    TraceSpan trace_span(__func__);
+    // Prepare everything the child needs, because it must not allocate.
+    std::string command = this->hook + " \"$@\"";
+    std::string workdir = this->workdir.string();
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return false;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if (chdir(workdir.data()) == 0)
+        {
+            execl("/bin/sh", "sh", "-c", command.data(), this->hook.data(), "2", token.data(),
+                  static_cast<char*>(nullptr));
+        }
+        _exit(127);
+    }
+    close(fds[1]);
+    std::string response;
+    char buf[65536];
+    ssize_t count;
+    while ((count = read(fds[0], buf, sizeof buf / sizeof *buf)) > 0)
+    {
+        response.append(buf, count);
+    }
+    close(fds[0]);
+    int status;
+    if (waitpid(pid, &status, 0) != pid)
+    {
+        LOG_DEBUG(logger, "Could not wait for fsmonitor hook", "hook", this->hook, "errno", errno);
+        return false;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        LOG_DEBUG(logger, "fsmonitor hook failed", "hook", this->hook, "status", status);
+        return false;
+    }
+
+    // The response is the new token followed by the changed paths, each
+    // terminated by a null character. Directories end with a slash.
+    std::string_view response_view(response);
+    std::size_t pos = response_view.find('\0');
+    if (pos == std::string_view::npos)
+    {
+        return false;
+    }
+    new_token = response_view.substr(0, pos);
+    trivial = false;
+    for (std::size_t begin = pos + 1; begin < response_view.size(); begin = pos + 1)
+    {
+        pos = response_view.find('\0', begin);
+        if (pos == std::string_view::npos)
+        {
+            pos = response_view.size();
+        }
+        std::string_view changed_path = response_view.substr(begin, pos - begin);
+        if (changed_path == "/")
+        {
+            trivial = true;
+            break;
+        }
+        if (!changed_path.empty() && changed_path.back() == '/')
+        {
+            changed_path.remove_suffix(1);
+        }
+        if (changed_path.empty() || changed_path == ".git" || changed_path.rfind(".git/", 0) == 0)
+        {
+            continue;
+        }
+        // Changing an ignore file may change the statuses of files elsewhere.
+        std::size_t name_pos = changed_path.rfind('/');
+        if (changed_path.substr(name_pos == std::string_view::npos ? 0 : name_pos + 1) == ".gitignore")
+        {
+            trivial = true;
+            break;
+        }
+        changed_paths.emplace_back(changed_path);
+    }
+    LOG_DEBUG(logger, "Queried fsmonitor hook", "changed", changed_paths.size(), "trivial", trivial);
+    return true;
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef FSMONITOR_CLIENT_HH_
+#define FSMONITOR_CLIENT_HH_
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "libgit2.hh"
+#include "status_ledger.hh"
+
+/**
+ * Obtain the statuses of the files in a Git repository by asking the file
+ * system monitor configured for it (`core.fsmonitor`, speaking version 2 of
+ * the hook protocol) which paths changed since the previous prompt, and
+ * examining only those. The statuses and the token identifying the previous
+ * query are remembered across prompts.
+ */
+class FsmonitorClient
+{
+private:
+    C::git_repository* repo;
+    std::string hook;
+    std::filesystem::path path, workdir;
+    std::string fingerprint;
+
+public:
+    FsmonitorClient(C::git_repository*, C::git_oid const*);
+    bool get_counts(unsigned&, unsigned&, unsigned&);
+
+private:
+    bool load(std::string&, StatusLedger&) const;
+    void store(std::string const&, StatusLedger const&) const;
+    bool query(std::string const&, std::string&, std::vector<std::string>&, bool&) const;
+};
+
+#endif
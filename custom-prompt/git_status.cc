@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <set>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "dirty_detector.hh"
+#include "git_status.hh"
+#include "index_file.hh"
+#include "json_logger.hh"
+#include "output_buffer.hh"
+#include "thread_pool.hh"
+#include "trace_span.hh"
+#include "untracked_cache.hh"
+
+static JSONLogger logger;
+
+/**
+ * Read the limits from the environment variable `CUSTOM_PROMPT_STATUS_LIMITS`,
+ * which is either a single number applying to modified, staged and untracked
+ * files alike, or up to three comma-separated numbers applying to them
+ * respectively (the last number given applies to the rest). A non-positive
+ * number means no limit.
+ */
+StatusLimits::StatusLimits(void) :
+    dirty(std::numeric_limits<unsigned>::max()), staged(std::numeric_limits<unsigned>::max()),
+    untracked(std::numeric_limits<unsigned>::max())
+{
+    char const* limits_env = std::getenv("CUSTOM_PROMPT_STATUS_LIMITS");
+    if (limits_env == nullptr)
+    {
+        return;
+    }
+    unsigned* limits[] = { &this->dirty, &this->staged, &this->untracked };
+    long long limit = 0;
+    for (unsigned* limit_ptr : limits)
+    {
+        char* end;
+        if (*limits_env != '\0')
+        {
+            limit = std::strtoll(limits_env, &end, 10);
+            limits_env = *end == ',' ? end + 1 : end;
+        }
+        if (limit > 0 && limit < std::numeric_limits<unsigned>::max())
+        {
+            *limit_ptr = limit;
+        }
+    }
+}
+
+/**
+ * Initialise all counts to zero.
+ */
+StatusCounts::StatusCounts(void) : dirty(0), staged(0), untracked(0)
+{
+}
+
+/**
+ * Check whether all counts have exceeded their limits, in which case there is
+ * no point in counting any further.
+ *
+ * @return Whether all counts have exceeded their limits.
+ */
+bool StatusCounts::saturated(void) const
+{
+    return this->dirty > this->limits.dirty && this->staged > this->limits.staged
+        && this->untracked > this->limits.untracked;
+}
+
+/**
+ * Add the given counts to these.
+ *
+ * @param other Counts to add.
+ *
+ * @return These counts.
+ */
+StatusCounts& StatusCounts::operator+=(StatusCounts const& other)
+{
+    // Counts exceeding their limits are all equivalent.
+    this->dirty = std::min<unsigned long long>(0ULL + this->dirty + other.dirty, this->limits.dirty + 1ULL);
+    this->staged = std::min<unsigned long long>(0ULL + this->staged + other.staged, this->limits.staged + 1ULL);
+    this->untracked
+        = std::min<unsigned long long>(0ULL + this->untracked + other.untracked, this->limits.untracked + 1ULL);
+    this->untracked_directories.insert(
+        this->untracked_directories.end(), other.untracked_directories.begin(), other.untracked_directories.end()
+    );
+    return *this;
+}
+
+/**
+ * Check whether the given file is modified, staged or untracked. If it is,
+ * update the corresponding members of the given `StatusCounts` instance,
+ * unless they have already exceeded their limits.
+ *
+ * @param path File path.
+ * @param status_flags Flags indicating the status of the file.
+ * @param counts_ `StatusCounts` instance whose members should be updated.
+ *
+ * @return 1 if all counts have exceeded their limits, 0 otherwise.
+ */
+static int update_status_counts(char const* path, unsigned status_flags, void* counts_)
+{
+    StatusCounts* counts = static_cast<StatusCounts*>(counts_);
+    if ((status_flags & DIRTY_STATUS_FLAGS) && counts->dirty <= counts->limits.dirty)
+    {
+        LOG_DEBUG(logger, "Found file in repository", "path", path, "status", "dirty");
+        ++counts->dirty;
+    }
+    if ((status_flags & STAGED_STATUS_FLAGS) && counts->staged <= counts->limits.staged)
+    {
+        LOG_DEBUG(logger, "Found file in repository", "path", path, "status", "staged");
+        ++counts->staged;
+    }
+    if ((status_flags & UNTRACKED_STATUS_FLAGS) && counts->untracked <= counts->limits.untracked)
+    {
+        LOG_DEBUG(logger, "Found file in repository", "path", path, "status", "untracked");
+        ++counts->untracked;
+        std::string_view path_view(path);
+        if (!path_view.empty() && path_view.back() == '/')
+        {
+            path_view.remove_suffix(1);
+            counts->untracked_directories.emplace_back(path_view);
+        }
+    }
+    if (counts->saturated())
+    {
+        // Found enough. Stop iterating.
+        LOG_DEBUG(logger, "Status counts saturated", "path", path);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Format a count for display: the count if it is within its limit, or the
+ * limit followed by a plus sign.
+ *
+ * @param output_buffer Output buffer.
+ * @param count Count.
+ * @param limit Limit of the count.
+ */
+void format_status_count(OutputBuffer& output_buffer, unsigned count, unsigned limit)
+{
+    if (count > limit)
+    {
+        output_buffer << limit << '+';
+        return;
+    }
+    output_buffer << count;
+}
+
+/**
+ * Count the files in a Git repository which are modified, staged or
+ * untracked.
+ *
+ * @param repo Git repository.
+ * @param pathspec Paths to limit the scan to, or a null pointer to scan
+ * everything.
+ * @param counts Counts to update.
+ *
+ * @return Whether the scan succeeded.
+ */
+static bool scan_status_paths(C::git_repository* repo, C::git_strarray const* pathspec, StatusCounts& counts)
+{
+    C::git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+    opts.flags = C::GIT_STATUS_OPT_INCLUDE_UNTRACKED | C::GIT_STATUS_OPT_EXCLUDE_SUBMODULES;
+    if (pathspec != nullptr)
+    {
+        opts.flags |= C::GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH;
+        opts.pathspec = *pathspec;
+    }
+    // Stopping early because the counts are saturated is not a failure.
+    return C::git_status_foreach_ext(repo, &opts, update_status_counts, &counts) == 0 || counts.saturated();
+}
+
+/**
+ * Split the working tree of a Git repository into shards: one for each
+ * top-level directory, and one for all top-level files. What is on disk, what
+ * is in the index and what is in the commit HEAD points to are all considered,
+ * so that deleted files (whether or not the deletions are staged) are not
+ * missed.
+ *
+ * @param repo Git repository.
+ * @param workdir Working tree.
+ *
+ * @return Paths in each shard.
+ */
+static std::vector<std::vector<std::string>> shard_working_tree(C::git_repository* repo, char const* workdir)
+{
+    std::set<std::string> directories, files;
+    IndexFile index_file;
+    if (index_file.load(repo))
+    {
+        for (std::string_view const& entry_path : index_file.paths)
+        {
+            std::size_t pos = entry_path.find('/');
+            if (pos == std::string_view::npos)
+            {
+                files.emplace(entry_path);
+            }
+            else
+            {
+                directories.emplace(entry_path.substr(0, pos));
+            }
+        }
+    }
+    C::git_oid oid;
+    C::git_commit* commit;
+    if (C::git_reference_name_to_id(&oid, repo, "HEAD") == 0 && C::git_commit_lookup(&commit, repo, &oid) == 0)
+    {
+        C::git_tree* tree;
+        if (C::git_commit_tree(&tree, commit) == 0)
+        {
+            for (std::size_t i = 0; i < C::git_tree_entrycount(tree); ++i)
+            {
+                C::git_tree_entry const* entry = C::git_tree_entry_byindex(tree, i);
+                if (C::git_tree_entry_type(entry) == C::GIT_OBJECT_TREE)
+                {
+                    directories.emplace(C::git_tree_entry_name(entry));
+                }
+                else
+                {
+                    files.emplace(C::git_tree_entry_name(entry));
+                }
+            }
+            C::git_tree_free(tree);
+        }
+        C::git_commit_free(commit);
+    }
+    std::error_code ec;
+    for (auto const& entry : std::filesystem::directory_iterator(workdir, ec))
+    {
+        std::string name = entry.path().filename().string();
+        if (name == ".git")
+        {
+            continue;
+        }
+        if (entry.is_directory(ec) && !entry.is_symlink(ec))
+        {
+            directories.insert(std::move(name));
+        }
+        else
+        {
+            files.insert(std::move(name));
+        }
+    }
+
+    std::vector<std::vector<std::string>> shards;
+    for (std::string const& directory : directories)
+    {
+        files.erase(directory);
+        shards.push_back({ directory });
+    }
+    if (!files.empty())
+    {
+        shards.emplace_back(files.begin(), files.end());
+    }
+    return shards;
+}
+
+/**
+ * Count the files in a Git repository which are modified, staged or
+ * untracked, using multiple threads. Each thread opens the repository on its
+ * own (since libgit2 objects must not be shared between threads) and scans
+ * shards of the working tree until none are left.
+ *
+ * @param repo Git repository.
+ * @param workdir Working tree.
+ * @param threads Number of threads.
+ * @param counts Counts to update.
+ *
+ * @return Whether the scan succeeded.
+ */
+static bool scan_status_sharded(
+    C::git_repository* repo, char const* workdir, std::size_t threads, StatusCounts& counts
+)
+{
+    std::vector<std::vector<std::string>> shards = shard_working_tree(repo, workdir);
+    threads = std::min(threads, shards.size());
+    LOG_DEBUG(logger, "Sharded working tree", "shards", shards.size(), "threads", threads);
+    std::vector<StatusCounts> thread_counts(threads);
+    std::atomic<std::size_t> next_shard(0);
+    std::atomic<bool> failed(false);
+    {
+        ThreadPool thread_pool(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+        {
+            thread_pool.submit(
+                [&, i]
+                {
+                    C::git_repository* thread_repo;
+                    if (C::git_repository_open(&thread_repo, workdir) != 0)
+                    {
+                        failed = true;
+                        return;
+                    }
+                    StatusCounts& thread_count = thread_counts[i];
+                    for (std::size_t shard;
+                         !failed && !thread_count.saturated() && (shard = next_shard++) < shards.size();)
+                    {
+                        std::vector<char*> strings;
+                        for (std::string& path : shards[shard])
+                        {
+                            strings.push_back(path.data());
+                        }
+                        C::git_strarray pathspec = { strings.data(), strings.size() };
+                        if (!scan_status_paths(thread_repo, &pathspec, thread_count))
+                        {
+                            failed = true;
+                        }
+                    }
+                    C::git_repository_free(thread_repo);
+                }
+            );
+        }
+    }
+    if (failed)
+    {
+        return false;
+    }
+    for (StatusCounts const& thread_count : thread_counts)
+    {
+        counts += thread_count;
+    }
+    return true;
+}
+
+/**
+ * Count the files in a Git repository which are modified, staged or untracked
+ * without having libgit2 walk the working tree: staged files are found by
+ * comparing the index with HEAD, modified files by comparing stat data, and
+ * untracked files by reading the working tree (only where it changed, if the
+ * untracked cache is enabled).
+ *
+ * @param repo Git repository.
+ * @param untracked_cache Untracked cache of the repository.
+ * @param counts Counts to update.
+ *
+ * @return Whether the scan succeeded. If not, the counts are not modified.
+ */
+static bool scan_status_from_index(C::git_repository* repo, UntrackedCache& untracked_cache, StatusCounts& counts)
+{
+    IndexFile index_file;
+    if (!index_file.load(repo))
+    {
+        return false;
+    }
+    StatusCounts found;
+    C::git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+    opts.show = C::GIT_STATUS_SHOW_INDEX_ONLY;
+    opts.flags = C::GIT_STATUS_OPT_EXCLUDE_SUBMODULES;
+    if (C::git_status_foreach_ext(repo, &opts, update_status_counts, &found) != 0 && !found.saturated())
+    {
+        return false;
+    }
+    DirtyDetector dirty_detector(repo, index_file);
+    if (!dirty_detector.count(found) || !untracked_cache.count(index_file, found))
+    {
+        return false;
+    }
+    counts += found;
+    return true;
+}
+
+/**
+ * Count the files in a Git repository which are modified, staged or
+ * untracked, without libgit2 walking the working tree, unless the untracked
+ * cache is disabled and the environment variable
+ * `CUSTOM_PROMPT_STATUS_THREADS` is set (to 0 to use all cores): then, the
+ * walk of libgit2 is sharded across threads instead.
+ *
+ * @param repo Git repository.
+ * @param counts Counts to update.
+ *
+ * @return Whether the scan succeeded.
+ */
+bool scan_status(C::git_repository* repo, StatusCounts& counts)
+{
+    TraceSpan trace_span(__func__);
+    UntrackedCache untracked_cache(repo);
+    std::size_t threads = ThreadPool::default_size("CUSTOM_PROMPT_STATUS_THREADS");
+    char const* workdir = C::git_repository_workdir(repo);
+    if (workdir != nullptr && (untracked_cache.is_enabled() || threads <= 1)
+        && scan_status_from_index(repo, untracked_cache, counts))
+    {
+        return true;
+    }
+    if (threads <= 1 || workdir == nullptr)
+    {
+        return scan_status_paths(repo, nullptr, counts);
+    }
+    return scan_status_sharded(repo, workdir, threads, counts);
+}
@@ -0,0 +1,47 @@
+#ifndef GIT_STATUS_HH_
+#define GIT_STATUS_HH_
+
+#include <string>
+#include <vector>
+
+#include "libgit2.hh"
+#include "output_buffer.hh"
+
+// Statuses which make a file count as modified, staged or untracked.
+unsigned constexpr DIRTY_STATUS_FLAGS
+    = C::GIT_STATUS_WT_DELETED | C::GIT_STATUS_WT_MODIFIED | C::GIT_STATUS_WT_RENAMED | C::GIT_STATUS_WT_TYPECHANGE;
+unsigned constexpr STAGED_STATUS_FLAGS = C::GIT_STATUS_INDEX_DELETED | C::GIT_STATUS_INDEX_MODIFIED
+    | C::GIT_STATUS_INDEX_NEW | C::GIT_STATUS_INDEX_RENAMED | C::GIT_STATUS_INDEX_TYPECHANGE;
+unsigned constexpr UNTRACKED_STATUS_FLAGS = C::GIT_STATUS_WT_NEW;
+
+/**
+ * Numbers of files in a Git repository beyond which modified, staged and
+ * untracked files need not be counted.
+ */
+struct StatusLimits
+{
+    unsigned dirty, staged, untracked;
+
+    StatusLimits(void);
+};
+
+/**
+ * Numbers of files in a Git repository which are modified, staged and
+ * untracked. A number exceeding its limit means that there are more files than
+ * the limit, not that there are exactly that many.
+ */
+struct StatusCounts
+{
+    unsigned dirty, staged, untracked;
+    StatusLimits limits;
+    std::vector<std::string> untracked_directories;
+
+    StatusCounts(void);
+    bool saturated(void) const;
+    StatusCounts& operator+=(StatusCounts const&);
+};
+
+void format_status_count(OutputBuffer&, unsigned, unsigned);
+bool scan_status(C::git_repository*, StatusCounts&);
+
+#endif
@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "index_file.hh"
+#include "json_logger.hh"
+#include "thread_pool.hh"
+#include "trace_span.hh"
+
+static JSONLogger logger;
+
+static std::size_t constexpr HEADER_SIZE = 12;
+static std::size_t constexpr STAT_DATA_SIZE = 40;
+static std::uint16_t constexpr NAME_MASK = 0x0FFF;
+static std::uint16_t constexpr EXTENDED_FLAG = 0x4000;
+
+/**
+ * Read a big-endian 32-bit integer.
+ *
+ * @param bytes Bytes.
+ *
+ * @return Integer.
+ */
+static std::uint32_t read_be32(unsigned char const* bytes)
+{
+    return static_cast<std::uint32_t>(bytes[0]) << 24 | static_cast<std::uint32_t>(bytes[1]) << 16
+        | static_cast<std::uint32_t>(bytes[2]) << 8 | static_cast<std::uint32_t>(bytes[3]);
+}
+
+/**
+ * Read a big-endian 16-bit integer.
+ *
+ * @param bytes Bytes.
+ *
+ * @return Integer.
+ */
+static std::uint16_t read_be16(unsigned char const* bytes)
+{
+    return static_cast<std::uint16_t>(bytes[0] << 8 | bytes[1]);
+}
+
+/**
+ * Prepare to read an index.
+ */
+IndexFile::IndexFile(void) : data(nullptr), size(0), index(nullptr), hash_size(20), version(0)
+{
+}
+
+/**
+ * Release the mapping, or the index read by libgit2.
+ */
+IndexFile::~IndexFile()
+{
+#ifndef _WIN32
+    if (this->data != nullptr)
+    {
+        munmap(const_cast<unsigned char*>(this->data), this->size);
+    }
+#endif
+    if (this->index != nullptr)
+    {
+        C::git_index_free(this->index);
+    }
+}
+
+/**
+ * Read the index of a Git repository. Index versions 2, 3 and 4 are supported.
+ * If the index has an Index Entry Offset Table (which Git writes if
+ * `index.threads` allows it), blocks of entries are read in parallel. If the
+ * index cannot be read (e.g. because it is split, or sparse), libgit2 is used
+ * to read it instead.
+ *
+ * @param repo Git repository.
+ *
+ * @return Whether the index was read.
+ */
+bool IndexFile::load(C::git_repository* repo)
+{
+    TraceSpan trace_span(__func__);
+    std::filesystem::path index_path = std::filesystem::path(C::git_repository_path(repo)) / "index";
+    if (this->map(index_path) && this->parse())
+    {
+        LOG_DEBUG(
+            logger, "Read index", "path", index_path.string(), "version", this->version, "entries", this->paths.size()
+        );
+        return true;
+    }
+    LOG_DEBUG(logger, "Reading index using libgit2", "path", index_path.string());
+    if (!this->load_from_libgit2(repo))
+    {
+        this->resize(0);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Obtain the number of entries.
+ *
+ * @return Number of entries.
+ */
+std::size_t IndexFile::entrycount(void) const
+{
+    return this->paths.size();
+}
+
+/**
+ * Map the index file into memory.
+ *
+ * @param index_path Index file path.
+ *
+ * @return Whether the file was mapped.
+ */
+bool IndexFile::map(std::filesystem::path const& index_path)
+{
+#ifdef _WIN32
+    std::ifstream index_file(index_path, std::ios::binary);
+    this->contents.assign(std::istreambuf_iterator<char>(index_file), std::istreambuf_iterator<char>());
+    this->data = reinterpret_cast<unsigned char const*>(this->contents.data());
+    this->size = this->contents.size();
+    return index_file.eof() && this->size > 0;
+#else
+    int fd = open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat index_stat;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &index_stat) == 0 && index_stat.st_size > 0)
+    {
+        mapping = mmap(nullptr, index_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    this->data = static_cast<unsigned char const*>(mapping);
+    this->size = index_stat.st_size;
+    return true;
+#endif
+}
+
+/**
+ * Parse the mapped index file.
+ *
+ * @return Whether all entries were parsed.
+ */
+bool IndexFile::parse(void)
+{
+    if (this->size < HEADER_SIZE + this->hash_size || std::memcmp(this->data, "DIRC", 4) != 0)
+    {
+        return false;
+    }
+    this->version = read_be32(this->data + 4);
+    if (this->version < 2 || this->version > 4)
+    {
+        return false;
+    }
+    std::size_t entrycount = read_be32(this->data + 8);
+    std::size_t entries_end = 0;
+    std::vector<std::size_t> block_offsets, block_firsts;
+    if (!this->find_blocks(entries_end, block_offsets, block_firsts))
+    {
+        return false;
+    }
+    if (block_offsets.empty())
+    {
+        block_offsets.push_back(HEADER_SIZE);
+        block_firsts.push_back(0);
+    }
+    block_firsts.push_back(entrycount);
+    std::size_t blocks = block_offsets.size();
+    if (block_offsets[0] != HEADER_SIZE || block_firsts[0] != 0
+        || !std::is_sorted(block_firsts.begin(), block_firsts.end()) || block_firsts[blocks] != entrycount)
+    {
+        return false;
+    }
+    this->resize(entrycount);
+    this->path_buffers.resize(blocks);
+
+    // Each block must end where the next one begins.
+    std::vector<std::size_t> block_ends(blocks);
+    std::size_t threads = std::min({ blocks, std::max<std::size_t>(1, std::thread::hardware_concurrency()),
+                                     std::max<std::size_t>(1, entrycount / ENTRIES_PER_THREAD) });
+    std::atomic<std::size_t> next_block(0);
+    std::atomic<bool> failed(false);
+    auto parse_blocks = [&]
+    {
+        for (std::size_t block; !failed && (block = next_block++) < blocks;)
+        {
+            block_ends[block] = this->parse_block(
+                block, block_offsets[block], block_firsts[block], block_firsts[block + 1] - block_firsts[block]
+            );
+            if (block_ends[block] == 0)
+            {
+                failed = true;
+            }
+        }
+    };
+    if (threads <= 1)
+    {
+        parse_blocks();
+    }
+    else
+    {
+        LOG_DEBUG(logger, "Reading index in parallel", "blocks", blocks, "threads", threads);
+        ThreadPool thread_pool(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+        {
+            thread_pool.submit(parse_blocks);
+        }
+    }
+    if (failed)
+    {
+        return false;
+    }
+    for (std::size_t block = 0; block + 1 < blocks; ++block)
+    {
+        if (block_ends[block] != block_offsets[block + 1])
+        {
+            return false;
+        }
+    }
+    // Without an End of Index Entry extension, where the extensions begin is
+    // known only now.
+    if (entries_end == 0)
+    {
+        std::vector<std::size_t> unused_offsets, unused_firsts;
+        entries_end = block_ends[blocks - 1];
+        return this->find_blocks(entries_end, unused_offsets, unused_firsts);
+    }
+    return block_ends[blocks - 1] == entries_end;
+}
+
+/**
+ * Find the blocks of entries listed in the Index Entry Offset Table, and
+ * check that the index has no extensions which change the meaning of the
+ * entries.
+ *
+ * @param entries_end Where the entries end. If 0, it is filled in from the End
+ * of Index Entry extension (if there is one, else it is left 0 and no blocks
+ * are found); otherwise, it is used to find the extensions.
+ * @param block_offsets Offsets of the blocks to fill in.
+ * @param block_firsts Indices of the first entries of the blocks to fill in.
+ *
+ * @return Whether the entries can be read.
+ */
+bool IndexFile::find_blocks(
+    std::size_t& entries_end, std::vector<std::size_t>& block_offsets, std::vector<std::size_t>& block_firsts
+)
+{
+    if (entries_end == 0)
+    {
+        // The End of Index Entry extension is the last one, and contains the
+        // offset and a hash. Its size also reveals the hash size.
+        for (std::size_t hash_size : { 20, 32 })
+        {
+            std::size_t eoie_size = 4 + hash_size;
+            if (this->size < HEADER_SIZE + 8 + eoie_size + hash_size)
+            {
+                continue;
+            }
+            unsigned char const* eoie = this->data + this->size - hash_size - eoie_size - 8;
+            if (std::memcmp(eoie, "EOIE", 4) == 0 && read_be32(eoie + 4) == eoie_size)
+            {
+                this->hash_size = hash_size;
+                entries_end = read_be32(eoie + 8);
+                break;
+            }
+        }
+        if (entries_end == 0)
+        {
+            return true;
+        }
+    }
+
+    std::size_t extensions_end = this->size - this->hash_size;
+    std::size_t offset = entries_end;
+    while (offset + 8 <= extensions_end)
+    {
+        unsigned char const* extension = this->data + offset;
+        std::size_t extension_size = read_be32(extension + 4);
+        if (extension_size > extensions_end - offset - 8)
+        {
+            return false;
+        }
+        if (std::memcmp(extension, "link", 4) == 0 || std::memcmp(extension, "sdir", 4) == 0)
+        {
+            LOG_DEBUG(logger, "Index is split or sparse");
+            return false;
+        }
+        if (std::memcmp(extension, "IEOT", 4) == 0 && extension_size >= 4 && read_be32(extension + 8) == 1)
+        {
+            std::size_t first = 0;
+            for (std::size_t pos = 12; pos + 8 <= extension_size + 8; pos += 8)
+            {
+                block_offsets.push_back(read_be32(extension + pos));
+                block_firsts.push_back(first);
+                first += read_be32(extension + pos + 4);
+            }
+        }
+        offset += 8 + extension_size;
+    }
+    return offset == extensions_end;
+}
+
+/**
+ * Parse a block of entries. For index version 4, the first path in a block
+ * shares no prefix with the previous one (whatever it says it removes from the
+ * previous path is ignored), so that blocks can be parsed independently.
+ *
+ * @param block Block number.
+ * @param offset Offset of the first entry.
+ * @param first Index of the first entry.
+ * @param count Number of entries.
+ *
+ * @return Offset right after the last entry, or 0 if the entries are invalid.
+ */
+std::size_t IndexFile::parse_block(std::size_t block, std::size_t offset, std::size_t first, std::size_t count)
+{
+    std::size_t limit = this->size - this->hash_size;
+    std::size_t fixed_size = STAT_DATA_SIZE + this->hash_size + 2;
+    std::string& path_buffer = this->path_buffers[block];
+    std::vector<std::size_t> path_offsets;
+    std::size_t previous_offset = 0, previous_length = 0;
+    for (std::size_t i = first; i < first + count; ++i)
+    {
+        if (fixed_size > limit - offset)
+        {
+            return 0;
+        }
+        unsigned char const* entry = this->data + offset;
+        this->ctime_seconds[i] = read_be32(entry);
+        this->ctime_nanoseconds[i] = read_be32(entry + 4);
+        this->mtime_seconds[i] = read_be32(entry + 8);
+        this->mtime_nanoseconds[i] = read_be32(entry + 12);
+        this->devs[i] = read_be32(entry + 16);
+        this->inos[i] = read_be32(entry + 20);
+        this->modes[i] = read_be32(entry + 24);
+        this->uids[i] = read_be32(entry + 28);
+        this->gids[i] = read_be32(entry + 32);
+        this->file_sizes[i] = read_be32(entry + 36);
+        this->oids[i] = entry + STAT_DATA_SIZE;
+        this->flags[i] = read_be16(entry + STAT_DATA_SIZE + this->hash_size);
+        std::size_t pos = offset + fixed_size;
+        if (this->flags[i] & EXTENDED_FLAG)
+        {
+            if (this->version < 3 || pos + 2 > limit)
+            {
+                return 0;
+            }
+            this->extended_flags[i] = read_be16(this->data + pos);
+            pos += 2;
+        }
+
+        if (this->version == 4)
+        {
+            // The path is stored as the number of characters to remove from
+            // the end of the previous path, followed by the characters to
+            // append to what remains.
+            if (pos >= limit)
+            {
+                return 0;
+            }
+            unsigned char c = this->data[pos++];
+            std::size_t strip = c & 0x7F;
+            while (c & 0x80)
+            {
+                if (pos >= limit || strip > limit)
+                {
+                    return 0;
+                }
+                c = this->data[pos++];
+                strip = ((strip + 1) << 7) | (c & 0x7F);
+            }
+            void const* nul = std::memchr(this->data + pos, '\0', limit - pos);
+            if (i == first)
+            {
+                strip = previous_length;
+            }
+            if (nul == nullptr || strip > previous_length)
+            {
+                return 0;
+            }
+            std::size_t suffix_length = static_cast<unsigned char const*>(nul) - (this->data + pos);
+            std::size_t path_offset = path_buffer.size();
+            path_buffer.append(path_buffer, previous_offset, previous_length - strip);
+            path_buffer.append(reinterpret_cast<char const*>(this->data + pos), suffix_length);
+            path_offsets.push_back(path_offset);
+            previous_offset = path_offset;
+            previous_length = previous_length - strip + suffix_length;
+            offset = pos + suffix_length + 1;
+            continue;
+        }
+
+        // The path is padded with null characters to a multiple of 8 bytes.
+        std::size_t length = this->flags[i] & NAME_MASK;
+        if (length == NAME_MASK)
+        {
+            void const* nul = std::memchr(this->data + pos, '\0', limit - pos);
+            if (nul == nullptr)
+            {
+                return 0;
+            }
+            length = static_cast<unsigned char const*>(nul) - (this->data + pos);
+        }
+        std::size_t entry_size = (pos - offset + length + 8) & ~static_cast<std::size_t>(7);
+        if (entry_size > limit - offset)
+        {
+            return 0;
+        }
+        this->paths[i] = std::string_view(reinterpret_cast<char const*>(this->data + pos), length);
+        offset += entry_size;
+    }
+
+    // The buffer will no longer grow, so the paths in it can be referred to.
+    for (std::size_t j = 0; j < path_offsets.size(); ++j)
+    {
+        std::size_t path_end = j + 1 < path_offsets.size() ? path_offsets[j + 1] : path_buffer.size();
+        this->paths[first + j] = std::string_view(path_buffer).substr(path_offsets[j], path_end - path_offsets[j]);
+    }
+    return offset;
+}
+
+/**
+ * Read the index of a Git repository using libgit2.
+ *
+ * @param repo Git repository.
+ *
+ * @return Whether the index was read.
+ */
+bool IndexFile::load_from_libgit2(C::git_repository* repo)
+{
+    if (C::git_repository_index(&this->index, repo) != 0)
+    {
+        this->index = nullptr;
+        return false;
+    }
+    std::size_t entrycount = C::git_index_entrycount(this->index);
+    this->hash_size = 20;
+    this->resize(entrycount);
+    for (std::size_t i = 0; i < entrycount; ++i)
+    {
+        C::git_index_entry const* entry = C::git_index_get_byindex(this->index, i);
+        this->paths[i] = entry->path;
+        this->ctime_seconds[i] = entry->ctime.seconds;
+        this->ctime_nanoseconds[i] = entry->ctime.nanoseconds;
+        this->mtime_seconds[i] = entry->mtime.seconds;
+        this->mtime_nanoseconds[i] = entry->mtime.nanoseconds;
+        this->devs[i] = entry->dev;
+        this->inos[i] = entry->ino;
+        this->modes[i] = entry->mode;
+        this->uids[i] = entry->uid;
+        this->gids[i] = entry->gid;
+        this->file_sizes[i] = entry->file_size;
+        this->flags[i] = entry->flags;
+        this->extended_flags[i] = entry->flags_extended;
+        this->oids[i] = entry->id.id;
+    }
+    return true;
+}
+
+/**
+ * Make room for the given number of entries.
+ *
+ * @param entrycount Number of entries.
+ */
+void IndexFile::resize(std::size_t entrycount)
+{
+    for (auto* field : { &this->ctime_seconds, &this->ctime_nanoseconds, &this->mtime_seconds,
+                         &this->mtime_nanoseconds, &this->devs, &this->inos, &this->modes, &this->uids, &this->gids,
+                         &this->file_sizes })
+    {
+        field->assign(entrycount, 0);
+    }
+    this->paths.assign(entrycount, {});
+    this->flags.assign(entrycount, 0);
+    this->extended_flags.assign(entrycount, 0);
+    this->oids.assign(entrycount, nullptr);
+}
@@ -0,0 +1,61 @@
+#ifndef INDEX_FILE_HH_
+#define INDEX_FILE_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "libgit2.hh"
+
+/**
+ * Entries of the index of a Git repository, read by mapping the index file
+ * into memory. Each field of the entries is stored in an array of its own, so
+ * that code looking at only a few fields of every entry touches little memory.
+ *
+ * Paths and object IDs point into the mapping (or, for index version 4, into
+ * buffers owned by this object), so they are valid only as long as it is.
+ */
+class IndexFile
+{
+private:
+    // Entries read at a time by a thread. Reading fewer is not worth the cost
+    // of starting a thread.
+    static std::size_t constexpr ENTRIES_PER_THREAD = 10000;
+    unsigned char const* data;
+    std::size_t size;
+#ifdef _WIN32
+    std::string contents;
+#endif
+    C::git_index* index;
+    std::size_t hash_size;
+    std::uint32_t version;
+    std::vector<std::string> path_buffers;
+
+public:
+    std::vector<std::string_view> paths;
+    std::vector<std::uint32_t> ctime_seconds, ctime_nanoseconds, mtime_seconds, mtime_nanoseconds;
+    std::vector<std::uint32_t> devs, inos, modes, uids, gids, file_sizes;
+    std::vector<std::uint16_t> flags, extended_flags;
+    std::vector<unsigned char const*> oids;
+
+public:
+    IndexFile(void);
+    IndexFile(IndexFile const&) = delete;
+    IndexFile& operator=(IndexFile const&) = delete;
+    ~IndexFile();
+    bool load(C::git_repository*);
+    std::size_t entrycount(void) const;
+
+private:
+    bool map(std::filesystem::path const&);
+    bool parse(void);
+    bool find_blocks(std::size_t&, std::vector<std::size_t>&, std::vector<std::size_t>&);
+    std::size_t parse_block(std::size_t, std::size_t, std::size_t, std::size_t);
+    bool load_from_libgit2(C::git_repository*);
+    void resize(std::size_t);
+};
+
+#endif
@@ -1,101 +1,221 @@
-#include <cstdint>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <iostream>
-#include <sstream>
 #include <string_view>
-#include <utility>
-#include <variant>
-#include <vector>
 
 #include "json_logger.hh"
+#include "log_sink.hh"
 
 #define LEFT_CURLY_BRACKET "\x7B"
 #define RIGHT_CURLY_BRACKET "\x7D"
 
-JSONString::JSONString(char const* s) : sv(s)
+/**
+ * Prepare an empty buffer.
+ */
+JSONBuffer::JSONBuffer(void) : size(0)
 {
 }
 
-JSONString::JSONString(std::string const& s) : sv(s)
+/**
+ * Write text as it is, as much of it as fits.
+ *
+ * @param text Text.
+ */
+void JSONBuffer::append(std::string_view text)
 {
+    std::size_t count = std::min(text.size(), this->available());
+    std::memcpy(this->end(), text.data(), count);
+    this->size += count;
 }
 
-JSONString::JSONString(std::string_view const& s) : sv(s)
+/**
+ * Write a string, escaping the characters which must be escaped. Other
+ * characters (including those of multi-byte UTF-8 sequences) are written as
+ * they are.
+ *
+ * @param text String.
+ */
+void JSONBuffer::append_escaped(std::string_view text)
 {
-}
-
-JSONString::JSONString(JSONString const& s) : sv(s.sv)
-{
-}
-
-std::ostream& operator<<(std::ostream& ostream, JSONString const& json_string)
-{
-    ostream << '"';
-    for (auto const& c : json_string.sv)
+    for (char const& c : text)
     {
+        char escaped[8] = { '\\' };
+        std::size_t escaped_size = 2;
         switch (c)
         {
         case '\t':
-            ostream << "\\t";
+            escaped[1] = 't';
             break;
         case '\n':
-            ostream << "\\n";
+            escaped[1] = 'n';
             break;
-        case '\v':
-            ostream << "\\v";
+        case '\r':
+            escaped[1] = 'r';
             break;
         case '"':
-            ostream << "\\\"";
+        case '\\':
+            escaped[1] = c;
             break;
         default:
-            if (std::isprint(c))
+            if (static_cast<unsigned char>(c) >= 0x20)
             {
-                ostream << c;
+                escaped[0] = c;
+                escaped_size = 1;
             }
             else
             {
-                ostream << "\\x" << static_cast<int>(c);
+                escaped_size = std::snprintf(escaped, sizeof escaped, "\\u%04x", c);
             }
         }
+        if (escaped_size > this->available())
+        {
+            return;
+        }
+        this->append(std::string_view(escaped, escaped_size));
     }
-    ostream << '"';
-    return ostream;
 }
 
-void JSONLogger::log_debug(
-    char const* file, char const* func, std::uintmax_t line, char const* msg,
-    std::vector<std::pair<JSONKey, JSONValue>> msg_args
-)
+/**
+ * Write a Boolean.
+ *
+ * @param value Boolean.
+ */
+void JSONBuffer::append_value(bool value)
 {
-    std::time_t curr_time = std::time(nullptr);
-    char curr_time_buf[32];
-    std::strftime(curr_time_buf, sizeof curr_time_buf / sizeof *curr_time_buf, "%FT%T%z", std::localtime(&curr_time));
+    this->append(value ? "true" : "false");
+}
 
-    std::ostringstream oss;
-    oss << LEFT_CURLY_BRACKET << JSONString("created") << ":" << JSONString(curr_time_buf);
-    oss << ',' << JSONString("source") << ":" LEFT_CURLY_BRACKET << JSONString("file") << ":" << JSONString(file)
-        << ',' << JSONString("func") << ":" << JSONString(func) << ',' << JSONString("line") << ":" << line
-        << RIGHT_CURLY_BRACKET;
-    oss << ',' << JSONString("msg") << ":" << JSONString(msg);
+/**
+ * Write a floating-point number. Not all standard library implementations
+ * support formatting floating-point numbers using `std::to_chars`, so use a
+ * different function.
+ *
+ * @param value Floating-point number.
+ */
+void JSONBuffer::append_value(double value)
+{
+    char buf[32];
+    int count = std::snprintf(buf, sizeof buf, "%.17g", value);
+    if (count > 0)
+    {
+        this->append(std::string_view(buf, std::min<std::size_t>(count, sizeof buf - 1)));
+    }
+}
+
+/**
+ * Write a string.
+ *
+ * @param value String.
+ */
+void JSONBuffer::append_value(char const* value)
+{
+    this->append_value(std::string_view(value));
+}
 
-    if (!msg_args.empty())
+/**
+ * Write a string.
+ *
+ * @param value String.
+ */
+void JSONBuffer::append_value(std::string_view value)
+{
+    this->append("\"");
+    this->append_escaped(value);
+    this->append("\"");
+}
+
+/**
+ * Write the last piece of text, using the space kept in reserve if necessary.
+ *
+ * @param text Text. Must not be longer than the reserved space.
+ */
+void JSONBuffer::close(std::string_view text)
+{
+    text = text.substr(0, CAPACITY - this->size);
+    std::memcpy(this->end(), text.data(), text.size());
+    this->size += text.size();
+}
+
+/**
+ * Obtain the text written.
+ *
+ * @return Text.
+ */
+std::string_view JSONBuffer::view(void) const
+{
+    return std::string_view(this->data, this->size);
+}
+
+/**
+ * Obtain the position to write at.
+ *
+ * @return Position.
+ */
+char* JSONBuffer::end(void)
+{
+    return this->data + this->size;
+}
+
+/**
+ * Obtain the amount of space left, apart from the reserved space.
+ *
+ * @return Number of characters which can be written.
+ */
+std::size_t JSONBuffer::available(void) const
+{
+    return this->size + RESERVE >= CAPACITY ? 0 : CAPACITY - RESERVE - this->size;
+}
+
+/**
+ * Write the beginning of a log record.
+ *
+ * @param buffer Buffer.
+ * @param source JSON text describing the source location.
+ * @param func Function name.
+ * @param msg JSON text of the message.
+ */
+void JSONLogger::begin(JSONBuffer& buffer, std::string_view source, char const* func, std::string_view msg)
+{
+    // Formatting the time is slow. Do it at most once per second per thread.
+    thread_local std::time_t prev_time = -1;
+    thread_local char curr_time_buf[32];
+    thread_local std::size_t curr_time_size = 0;
+    std::time_t curr_time = std::time(nullptr);
+    if (curr_time != prev_time)
     {
-        oss << ',' << JSONString("msg_args") << ":" << LEFT_CURLY_BRACKET;
-        char const* delimiter = "";
-        char const* actual_delimiter = ",";
-        for (auto const& msg_arg : msg_args)
-        {
-            std::visit(
-                [&](auto const& val)
-                {
-                    oss << delimiter << msg_arg.first << ":" << val;
-                },
-                msg_arg.second
-            );
-            delimiter = actual_delimiter;
-        }
-        oss << RIGHT_CURLY_BRACKET;
+        std::tm curr_tm;
+#ifdef _WIN32
+        localtime_s(&curr_tm, &curr_time);
+#else
+        localtime_r(&curr_time, &curr_tm);
+#endif
+        curr_time_size
+            = std::strftime(curr_time_buf, sizeof curr_time_buf / sizeof *curr_time_buf, "%FT%T%z", &curr_tm);
+        prev_time = curr_time;
+    }
+    buffer.append(LEFT_CURLY_BRACKET "\"created\":\"");
+    buffer.append(std::string_view(curr_time_buf, curr_time_size));
+    buffer.append("\"");
+    buffer.append(source);
+    buffer.append(func);
+    buffer.append(msg);
+}
+
+/**
+ * Write the end of a log record, and output it to the log file, or to standard
+ * error if there is none.
+ *
+ * @param buffer Buffer.
+ */
+void JSONLogger::end(JSONBuffer& buffer)
+{
+    buffer.close(RIGHT_CURLY_BRACKET "\n");
+    std::string_view record = buffer.view();
+    if (!LogSink::write(record))
+    {
+        std::clog.write(record.data(), record.size());
     }
-    oss << RIGHT_CURLY_BRACKET "\n";
-    std::clog << oss.str();
 }
@@ -1,40 +1,153 @@
 #ifndef JSON_LOGGER_HH_
 #define JSON_LOGGER_HH_
 
-#include <cstdint>
-#include <iostream>
+#include <charconv>
+#include <cstddef>
 #include <string_view>
-#include <utility>
-#include <variant>
-#include <vector>
+#include <type_traits>
 
-class JSONString
+/**
+ * Fixed-size buffer into which JSON text is formatted without allocating. If
+ * the text does not fit, it is truncated, but some space is kept in reserve so
+ * that it can still be terminated.
+ */
+class JSONBuffer
 {
+public:
+    static std::size_t constexpr CAPACITY = 1024;
+
 private:
-    std::string_view sv;
+    static std::size_t constexpr RESERVE = 8;
+    char data[CAPACITY];
+    std::size_t size;
 
 public:
-    JSONString(char const*);
-    JSONString(std::string const&);
-    JSONString(std::string_view const&);
-    JSONString(JSONString const&);
+    JSONBuffer(void);
+    void append(std::string_view);
+    void append_escaped(std::string_view);
+    void append_value(bool);
+    void append_value(double);
+    void append_value(char const*);
+    void append_value(std::string_view);
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>> void append_value(T);
+    void close(std::string_view);
+    std::string_view view(void) const;
 
-    friend std::ostream& operator<<(std::ostream&, JSONString const&);
+private:
+    char* end(void);
+    std::size_t available(void) const;
 };
 
-using JSONKey = JSONString;
-using JSONValue = std::variant<double, int, long, long long, long long unsigned, long unsigned, unsigned, JSONString>;
+/**
+ * Write an integer.
+ *
+ * @param value Integer.
+ */
+template <typename T, typename> void JSONBuffer::append_value(T value)
+{
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof buf, value);
+    this->append(std::string_view(buf, result.ptr - buf));
+}
+
+/**
+ * Check whether a string literal can be placed in JSON text as it is.
+ *
+ * @param literal String literal.
+ *
+ * @return Whether it contains no characters which need escaping.
+ */
+template <std::size_t N> constexpr bool json_is_plain(char const (&literal)[N])
+{
+    for (std::size_t i = 0; i + 1 < N; ++i)
+    {
+        if (literal[i] == '"' || literal[i] == '\\' || static_cast<unsigned char>(literal[i]) < 0x20)
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
 class JSONLogger
 {
 public:
-    void log_debug(
-        char const*, char const*, std::uintmax_t, char const* msg, std::vector<std::pair<JSONKey, JSONValue>> = {}
-    );
+    template <typename... Args> void log_debug(std::string_view, char const*, std::string_view, Args const&...);
+
+private:
+    void begin(JSONBuffer&, std::string_view, char const*, std::string_view);
+    void end(JSONBuffer&);
+    template <std::size_t N, typename Value, typename... Args>
+    void append_msg_args(JSONBuffer&, char const*, char const (&)[N], Value const&, Args const&...);
 };
 
+/**
+ * Write a log record.
+ *
+ * @param source JSON text describing the source location (up to the function
+ * name, which is not a string literal), prepared at compile time.
+ * @param func Function name.
+ * @param msg JSON text of the message, prepared at compile time.
+ * @param args Alternating keys (string literals, written as they are) and
+ * values (Booleans, numbers or strings) of the message arguments.
+ */
+template <typename... Args>
+void JSONLogger::log_debug(std::string_view source, char const* func, std::string_view msg, Args const&... args)
+{
+    static_assert(sizeof...(Args) % 2 == 0, "message arguments must be key-value pairs");
+    JSONBuffer buffer;
+    this->begin(buffer, source, func, msg);
+    if constexpr (sizeof...(Args) > 0)
+    {
+        buffer.append(",\"msg_args\":\x7B");
+        this->append_msg_args(buffer, "", args...);
+        buffer.append("\x7D");
+    }
+    this->end(buffer);
+}
+
+/**
+ * Write message arguments.
+ *
+ * @param buffer Buffer.
+ * @param delimiter Text to write before the first key.
+ * @param key Key.
+ * @param value Value.
+ * @param args Remaining keys and values.
+ */
+template <std::size_t N, typename Value, typename... Args>
+void JSONLogger::append_msg_args(
+    JSONBuffer& buffer, char const* delimiter, char const (&key)[N], Value const& value, Args const&... args
+)
+{
+    buffer.append(delimiter);
+    buffer.append("\"");
+    buffer.append(std::string_view(key, N - 1));
+    buffer.append("\":");
+    buffer.append_value(value);
+    if constexpr (sizeof...(Args) > 0)
+    {
+        this->append_msg_args(buffer, ",", args...);
+    }
+}
+
+#define JSON_LOGGER_STRINGIFY_(x) #x
+#define JSON_LOGGER_STRINGIFY(x) JSON_LOGGER_STRINGIFY_(x)
+#define JSON_LOGGER_LITERAL(s) std::string_view(s, sizeof s - 1)
+
+// The source location and the message are string literals, so they are
+// formatted at compile time. Keys are not checked, so they must be plain.
 #ifndef NDEBUG
-#define LOG_DEBUG(logger, ...) logger.log_debug(__FILE__, __func__, __LINE__ __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_DEBUG(logger, msg, ...)                                                                                   \
+    do                                                                                                                \
+    {                                                                                                                 \
+        static_assert(json_is_plain(__FILE__) && json_is_plain(msg), "message must not need escaping");               \
+        logger.log_debug(                                                                                             \
+            JSON_LOGGER_LITERAL(",\"source\":\x7B\"file\":\"" __FILE__ "\",\"line\":" JSON_LOGGER_STRINGIFY(__LINE__) \
+                                ",\"func\":\""),                                                                      \
+            __func__, JSON_LOGGER_LITERAL("\"\x7D,\"msg\":\"" msg "\"") __VA_OPT__(, ) __VA_ARGS__                    \
+        );                                                                                                            \
+    } while (false)
 #else
 #define LOG_DEBUG(...)
 #endif
@@ -0,0 +1,21 @@
+#ifndef LIBGIT2_HH_
+#define LIBGIT2_HH_
+
+// libgit2 is included in a namespace of its own so that it is obvious where
+// its functions are called. The standard headers it includes must have been
+// included beforehand, or their contents will end up in that namespace too.
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <sys/types.h>
+
+namespace C
+{
+#include <git2.h>
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifdef __linux__
+#include <dlfcn.h>
+#endif
+
+#include "json_logger.hh"
+#include "libnotify_loader.hh"
+
+#ifdef __linux__
+namespace C
+{
+#include <libnotify/notify.h>
+}
+#endif
+
+static JSONLogger logger;
+
+#ifdef __linux__
+/**
+ * Functions of libnotify, which is loaded only when a notification is to be
+ * sent, because loading it (and GLib, GIO and D-Bus, which it depends on) is
+ * slow, and most prompts send no notifications.
+ */
+struct LibNotify
+{
+    decltype(&C::notify_init) notify_init;
+    decltype(&C::notify_notification_new) notify_notification_new;
+    decltype(&C::notify_notification_show) notify_notification_show;
+};
+
+/**
+ * Load libnotify and initialise it.
+ *
+ * @return Functions of libnotify. All of them are null pointers if it could not
+ * be loaded or initialised.
+ */
+static LibNotify load_libnotify(void)
+{
+    void* handle = dlopen("libnotify.so.4", RTLD_LAZY | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+        handle = dlopen("libnotify.so", RTLD_LAZY | RTLD_LOCAL);
+    }
+    if (handle == nullptr)
+    {
+        LOG_DEBUG(logger, "Could not load libnotify", "error", dlerror());
+        return {};
+    }
+    LibNotify libnotify = {
+        reinterpret_cast<decltype(&C::notify_init)>(dlsym(handle, "notify_init")),
+        reinterpret_cast<decltype(&C::notify_notification_new)>(dlsym(handle, "notify_notification_new")),
+        reinterpret_cast<decltype(&C::notify_notification_show)>(dlsym(handle, "notify_notification_show")),
+    };
+    if (libnotify.notify_init == nullptr || libnotify.notify_notification_new == nullptr
+        || libnotify.notify_notification_show == nullptr || !libnotify.notify_init("Terminal"))
+    {
+        // It is not unloaded even so, because initialising it may have
+        // brought in GLib, which cannot be unloaded safely.
+        LOG_DEBUG(logger, "Could not initialise libnotify");
+        return {};
+    }
+    LOG_DEBUG(logger, "Loaded libnotify");
+    return libnotify;
+}
+#endif
+
+/**
+ * Send a desktop notification using libnotify, loading it the first time. It
+ * is never unloaded, because GLib cannot be unloaded safely.
+ *
+ * @param summary Title of the notification.
+ * @param body Text of the notification.
+ * @param icon Name of the icon of the notification.
+ *
+ * @return Whether the notification was sent. Always `false` on systems other
+ * than Linux.
+ */
+bool send_libnotify_notification(char const* summary, char const* body, char const* icon)
+{
+#ifdef __linux__
+    static LibNotify const libnotify = load_libnotify();
+    if (libnotify.notify_init == nullptr)
+    {
+        return false;
+    }
+    C::NotifyNotification* notif = libnotify.notify_notification_new(summary, body, icon);
+    return notif != nullptr && libnotify.notify_notification_show(notif, nullptr);
+#else
+    return false;
+#endif
+}
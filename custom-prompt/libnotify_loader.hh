@@ -0,0 +1,6 @@
+#ifndef LIBNOTIFY_LOADER_HH_
+#define LIBNOTIFY_LOADER_HH_
+
+bool send_libnotify_notification(char const*, char const*, char const*);
+
+#endif
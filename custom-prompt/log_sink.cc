@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "log_sink.hh"
+
+/**
+ * Sink of this process. A child process must not use the sink of its parent,
+ * because the writer thread does not exist in it.
+ */
+static std::atomic<LogSink*> log_sink(nullptr);
+
+/**
+ * Open the log file, which is named by the environment variable
+ * `CUSTOM_PROMPT_LOG`.
+ *
+ * @return Log file, or a null pointer if there is none.
+ */
+static std::FILE* open_log_file(void)
+{
+    char const* path = std::getenv("CUSTOM_PROMPT_LOG");
+    if (path == nullptr || *path == '\0')
+    {
+        return nullptr;
+    }
+    std::FILE* file = std::fopen(path, "ab");
+    if (file == nullptr)
+    {
+        return nullptr;
+    }
+    // Batches are written at once; buffering would only split them.
+    std::setvbuf(file, nullptr, _IONBF, 0);
+#ifndef _WIN32
+    pthread_atfork(
+        nullptr, nullptr,
+        []
+        {
+            // The records of the parent will be written by the parent.
+            log_sink.store(nullptr, std::memory_order_relaxed);
+        }
+    );
+#endif
+    std::atexit(LogSink::flush);
+    return file;
+}
+
+/**
+ * Prepare an empty queue.
+ *
+ * @param file Log file.
+ */
+LogSink::LogSink(std::FILE* file) :
+    slots(new Slot[SLOTS]), enqueue_pos(0), dequeue_pos(0), file(file), stopping(false)
+{
+    for (std::size_t i = 0; i < SLOTS; ++i)
+    {
+        this->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    this->batch.reserve(64 * JSONBuffer::CAPACITY);
+}
+
+LogSink::~LogSink()
+{
+    delete[] this->slots;
+}
+
+/**
+ * Write a log record to the log file, if there is one.
+ *
+ * @param record Log record.
+ *
+ * @return Whether the record was taken. If not, the caller should write it
+ * elsewhere.
+ */
+bool LogSink::write(std::string_view record)
+{
+    LogSink* sink = LogSink::get();
+    if (sink == nullptr)
+    {
+        return false;
+    }
+    // If the queue is full, wait for the writer to make room. Once it has
+    // been stopped, nothing will be taken from the queue any more.
+    while (!sink->stopping.load(std::memory_order_acquire))
+    {
+        if (sink->push(record))
+        {
+            return true;
+        }
+        std::this_thread::yield();
+    }
+    std::fwrite(record.data(), 1, record.size(), sink->file);
+    return true;
+}
+
+/**
+ * Write all queued log records, and stop the writer. Must be called before
+ * exiting without running exit handlers.
+ */
+void LogSink::flush(void)
+{
+    LogSink* sink = log_sink.load(std::memory_order_acquire);
+    if (sink != nullptr)
+    {
+        sink->stop();
+    }
+}
+
+/**
+ * Add a log record to the queue.
+ *
+ * @param record Log record.
+ *
+ * @return Whether there was room for it.
+ */
+bool LogSink::push(std::string_view record)
+{
+    std::size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true)
+    {
+        slot = &this->slots[pos % SLOTS];
+        std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == pos)
+        {
+            if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (sequence < pos)
+        {
+            return false;
+        }
+        else
+        {
+            pos = this->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    slot->size = std::min(record.size(), sizeof slot->data);
+    std::memcpy(slot->data, record.data(), slot->size);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * Remove all log records from the queue, and write them to the log file in as
+ * few batches as possible.
+ *
+ * @return Number of log records written.
+ */
+std::size_t LogSink::drain(void)
+{
+    std::size_t count = 0;
+    std::size_t pos = this->dequeue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot* slot = &this->slots[pos % SLOTS];
+        std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == pos + 1)
+        {
+            if (this->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                if (this->batch.size() + slot->size > this->batch.capacity())
+                {
+                    std::fwrite(this->batch.data(), 1, this->batch.size(), this->file);
+                    this->batch.clear();
+                }
+                this->batch.insert(this->batch.end(), slot->data, slot->data + slot->size);
+                slot->sequence.store(pos + SLOTS, std::memory_order_release);
+                ++pos;
+                ++count;
+            }
+        }
+        else if (sequence < pos + 1)
+        {
+            break;
+        }
+        else
+        {
+            pos = this->dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    if (!this->batch.empty())
+    {
+        std::fwrite(this->batch.data(), 1, this->batch.size(), this->file);
+        this->batch.clear();
+    }
+    return count;
+}
+
+/**
+ * Write log records until stopped. When the queue is empty, wait a little, so
+ * that records arriving in quick succession are written together.
+ */
+void LogSink::write_batches(void)
+{
+    while (!this->stopping.load(std::memory_order_acquire))
+    {
+        if (this->drain() == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+/**
+ * Stop the writer, and write the log records it did not.
+ */
+void LogSink::stop(void)
+{
+    if (this->stopping.exchange(true, std::memory_order_acq_rel))
+    {
+        return;
+    }
+    if (this->writer.joinable())
+    {
+        this->writer.join();
+    }
+    this->drain();
+}
+
+/**
+ * Obtain the sink of this process, creating it (and starting its writer) if
+ * necessary.
+ *
+ * @return Sink, or a null pointer if there is no log file.
+ */
+LogSink* LogSink::get(void)
+{
+    static std::FILE* file = open_log_file();
+    if (file == nullptr)
+    {
+        return nullptr;
+    }
+    LogSink* sink = log_sink.load(std::memory_order_acquire);
+    if (sink != nullptr)
+    {
+        return sink;
+    }
+    LogSink* new_sink = new LogSink(file);
+    if (!log_sink.compare_exchange_strong(sink, new_sink, std::memory_order_acq_rel))
+    {
+        delete new_sink;
+        return sink;
+    }
+    new_sink->writer = std::thread(&LogSink::write_batches, new_sink);
+    return new_sink;
+}
@@ -0,0 +1,52 @@
+#ifndef LOG_SINK_HH_
+#define LOG_SINK_HH_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "json_logger.hh"
+
+/**
+ * Write log records to a file in the background. Threads push records into a
+ * bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's
+ * design), which a writer thread drains in batches, so that logging costs
+ * little more than copying each record.
+ */
+class LogSink
+{
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence;
+        std::size_t size;
+        char data[JSONBuffer::CAPACITY];
+    };
+
+    static std::size_t constexpr SLOTS = 1024;
+    Slot* slots;
+    alignas(64) std::atomic<std::size_t> enqueue_pos;
+    alignas(64) std::atomic<std::size_t> dequeue_pos;
+    std::FILE* file;
+    std::vector<char> batch;
+    std::atomic<bool> stopping;
+    std::thread writer;
+
+public:
+    static bool write(std::string_view);
+    static void flush(void);
+
+private:
+    LogSink(std::FILE*);
+    ~LogSink();
+    bool push(std::string_view);
+    std::size_t drain(void);
+    void write_batches(void);
+    void stop(void);
+    static LogSink* get(void);
+};
+
+#endif
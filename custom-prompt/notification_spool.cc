@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "disk_cache.hh"
+#include "json_logger.hh"
+#include "libnotify_loader.hh"
+#include "notification_spool.hh"
+
+static JSONLogger logger;
+
+// Maximum number of notifications waiting to be sent. More are dropped, so
+// that a wedged notification daemon does not make the spool grow forever.
+static std::size_t constexpr NOTIFICATION_SPOOL_CAPACITY = 16;
+
+// Time for which the helper waits for other notifications to arrive before
+// sending, so that long commands finishing at once are reported together.
+static std::chrono::milliseconds constexpr NOTIFICATION_COALESCE_DELAY(50);
+
+static char const NOTIFICATION_SPOOL_LOCK[] = "lock";
+
+/**
+ * Obtain the directory in which notifications wait to be sent. It is created
+ * if it does not exist.
+ *
+ * @return Directory, or an empty path if there is no cache directory.
+ */
+static std::filesystem::path notification_spool_directory(void)
+{
+    std::filesystem::path directory = cache_file_path("notifications", "");
+    if (!directory.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directory(directory, ec);
+    }
+    return directory;
+}
+
+/**
+ * List the notifications waiting to be sent, oldest first.
+ *
+ * @param directory Spool directory.
+ *
+ * @return Paths of the notifications.
+ */
+static std::vector<std::filesystem::path> list_notifications(std::filesystem::path const& directory)
+{
+    std::vector<std::filesystem::path> paths;
+    std::error_code ec;
+    for (std::filesystem::directory_entry const& entry : std::filesystem::directory_iterator(directory, ec))
+    {
+        // Skip the lock file and files which are still being written.
+        std::string name = entry.path().filename().string();
+        if (name != NOTIFICATION_SPOOL_LOCK && name.find(".tmp") == std::string::npos)
+        {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+#ifdef __linux__
+/**
+ * Start the helper which sends the notifications waiting in the spool, without
+ * waiting for it. It is a new program (this one, started with the `--notify`
+ * option) in a new session, because this process may have other threads, and
+ * its output must not hold up the shell. Only async-signal-safe functions are
+ * called between forking and executing.
+ *
+ * @return Whether the helper was started.
+ */
+static bool start_notification_helper(void)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        return false;
+    }
+    if (pid == 0)
+    {
+        // Fork again, so that the helper is not a child of this process, which
+        // may live on (as a server) without reaping it.
+        setsid();
+        if (fork() != 0)
+        {
+            _exit(EXIT_SUCCESS);
+        }
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        for (int fd = STDERR_FILENO + 1; fd < 1024; ++fd)
+        {
+            close(fd);
+        }
+        execl("/proc/self/exe", "custom-prompt", "--notify", static_cast<char*>(nullptr));
+        _exit(EXIT_FAILURE);
+    }
+    waitpid(pid, nullptr, 0);
+    return true;
+}
+#endif
+
+/**
+ * Queue a desktop notification to be sent by a helper process, and make sure
+ * that one is running. This returns without waiting for the notification to be
+ * sent, so that a slow notification daemon does not delay the prompt.
+ *
+ * @param summary Title of the notification.
+ * @param body Text of the notification.
+ * @param icon Name of the icon of the notification.
+ *
+ * @return Whether the notification was queued. Always `false` on systems other
+ * than Linux.
+ */
+bool spool_notification(std::string_view summary, std::string_view body, std::string_view icon)
+{
+#ifdef __linux__
+    std::filesystem::path directory = notification_spool_directory();
+    if (directory.empty())
+    {
+        return false;
+    }
+    if (list_notifications(directory).size() >= NOTIFICATION_SPOOL_CAPACITY)
+    {
+        LOG_DEBUG(logger, "Dropping notification because the spool is full", "summary", summary);
+        return false;
+    }
+    std::string name = std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+    name += '-';
+    name += std::to_string(getpid());
+    std::string contents(summary);
+    contents += '\0';
+    contents += body;
+    contents += '\0';
+    contents += icon;
+    if (!replace_file_contents(directory / name, contents))
+    {
+        return false;
+    }
+    LOG_DEBUG(logger, "Spooled notification", "name", name);
+    return start_notification_helper();
+#else
+    return false;
+#endif
+}
+
+#ifdef __linux__
+/**
+ * Notification read from the spool.
+ */
+struct SpooledNotification
+{
+    std::string summary, body, icon;
+};
+
+/**
+ * Read a notification from the spool and remove it.
+ *
+ * @param path Path of the notification.
+ * @param notification Notification to fill in.
+ *
+ * @return Whether the notification was read.
+ */
+static bool take_notification(std::filesystem::path const& path, SpooledNotification& notification)
+{
+    std::string contents;
+    {
+        std::ifstream notification_file(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(notification_file), std::istreambuf_iterator<char>());
+    }
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    std::size_t body_begin = contents.find('\0');
+    std::size_t icon_begin = body_begin == std::string::npos ? body_begin : contents.find('\0', body_begin + 1);
+    if (icon_begin == std::string::npos)
+    {
+        return false;
+    }
+    notification.summary = contents.substr(0, body_begin);
+    notification.body = contents.substr(body_begin + 1, icon_begin - body_begin - 1);
+    notification.icon = contents.substr(icon_begin + 1);
+    return true;
+}
+
+/**
+ * Send the notifications waiting in the spool, several of them as one.
+ *
+ * @param directory Spool directory.
+ *
+ * @return Whether there were any.
+ */
+static bool send_spooled_notifications(std::filesystem::path const& directory)
+{
+    std::vector<SpooledNotification> notifications;
+    for (std::filesystem::path const& path : list_notifications(directory))
+    {
+        SpooledNotification notification;
+        if (take_notification(path, notification))
+        {
+            notifications.push_back(std::move(notification));
+        }
+    }
+    if (notifications.empty())
+    {
+        return false;
+    }
+    LOG_DEBUG(logger, "Sending spooled notifications", "count", notifications.size());
+    if (notifications.size() == 1)
+    {
+        SpooledNotification const& notification = notifications.front();
+        send_libnotify_notification(
+            notification.summary.data(), notification.body.data(), notification.icon.data()
+        );
+        return true;
+    }
+    std::string summary = std::to_string(notifications.size()) + " commands finished";
+    std::string body;
+    char const* icon = "dialog-information";
+    for (SpooledNotification const& notification : notifications)
+    {
+        body += notification.summary + ": " + notification.body + '\n';
+        if (notification.icon == "dialog-error")
+        {
+            icon = "dialog-error";
+        }
+    }
+    body.pop_back();
+    send_libnotify_notification(summary.data(), body.data(), icon);
+    return true;
+}
+#endif
+
+/**
+ * Send the notifications waiting in the spool until there are none left. Only
+ * one helper does so at a time; any other exits immediately, because the one
+ * holding the lock checks the spool again after releasing it.
+ *
+ * @return Exit code.
+ */
+int run_notification_helper(void)
+{
+#ifdef __linux__
+    std::filesystem::path directory = notification_spool_directory();
+    if (directory.empty())
+    {
+        return EXIT_FAILURE;
+    }
+    int lock_fd = open((directory / NOTIFICATION_SPOOL_LOCK).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    while (flock(lock_fd, LOCK_EX | LOCK_NB) == 0)
+    {
+        std::this_thread::sleep_for(NOTIFICATION_COALESCE_DELAY);
+        while (send_spooled_notifications(directory))
+        {
+        }
+        flock(lock_fd, LOCK_UN);
+        // A notification may have been queued after the spool was last
+        // checked, by a process whose helper found it locked.
+        if (list_notifications(directory).empty())
+        {
+            break;
+        }
+    }
+    close(lock_fd);
+    return EXIT_SUCCESS;
+#else
+    return EXIT_FAILURE;
+#endif
+}
@@ -0,0 +1,9 @@
+#ifndef NOTIFICATION_SPOOL_HH_
+#define NOTIFICATION_SPOOL_HH_
+
+#include <string_view>
+
+bool spool_notification(std::string_view, std::string_view, std::string_view);
+int run_notification_helper(void);
+
+#endif
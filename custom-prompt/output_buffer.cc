@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "output_buffer.hh"
+
+/**
+ * Prepare an empty buffer.
+ */
+OutputBuffer::OutputBuffer(void) : size(0)
+{
+}
+
+/**
+ * Write a character.
+ *
+ * @param c Character.
+ *
+ * @return This buffer.
+ */
+OutputBuffer& OutputBuffer::operator<<(char c)
+{
+    if (this->size < CAPACITY)
+    {
+        this->data[this->size++] = c;
+    }
+    return *this;
+}
+
+/**
+ * Write text.
+ *
+ * @param text Text.
+ *
+ * @return This buffer.
+ */
+OutputBuffer& OutputBuffer::operator<<(std::string_view text)
+{
+    std::size_t count = std::min(text.size(), CAPACITY - this->size);
+    std::memcpy(this->data + this->size, text.data(), count);
+    this->size += count;
+    return *this;
+}
+
+/**
+ * Write a number, padded with leading zeros.
+ *
+ * @param value Number.
+ * @param width Minimum number of digits.
+ */
+void OutputBuffer::append_padded(unsigned value, std::size_t width)
+{
+    char buf[16];
+    std::to_chars_result result = std::to_chars(buf, buf + sizeof buf, value);
+    for (std::size_t digits = result.ptr - buf; digits < width; ++digits)
+    {
+        *this << '0';
+    }
+    *this << std::string_view(buf, result.ptr - buf);
+}
+
+/**
+ * Obtain the text written.
+ *
+ * @return Text.
+ */
+std::string_view OutputBuffer::view(void) const
+{
+    return std::string_view(this->data, this->size);
+}
+
+/**
+ * Discard the text written.
+ */
+void OutputBuffer::clear(void)
+{
+    this->size = 0;
+}
+
+/**
+ * Output the text written. Unless it is too long for the file descriptor to
+ * take at once, this is a single system call.
+ *
+ * @param fd File descriptor.
+ *
+ * @return Whether all of the text was output.
+ */
+bool OutputBuffer::write_to(int fd) const
+{
+    for (std::size_t written = 0; written < this->size;)
+    {
+#ifdef _WIN32
+        int count = _write(fd, this->data + written, this->size - written);
+#else
+        ssize_t count = write(fd, this->data + written, this->size - written);
+#endif
+        if (count <= 0)
+        {
+            return false;
+        }
+        written += count;
+    }
+    return true;
+}
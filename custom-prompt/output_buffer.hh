@@ -0,0 +1,49 @@
+#ifndef OUTPUT_BUFFER_HH_
+#define OUTPUT_BUFFER_HH_
+
+#include <charconv>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+/**
+ * Fixed-size buffer in which text meant for the terminal is assembled without
+ * allocating, so that it can be output using a single system call. Text which
+ * does not fit is dropped.
+ */
+class OutputBuffer
+{
+private:
+    static std::size_t constexpr CAPACITY = 8192;
+    char data[CAPACITY];
+    std::size_t size;
+
+public:
+    OutputBuffer(void);
+    OutputBuffer& operator<<(char);
+    OutputBuffer& operator<<(std::string_view);
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>> OutputBuffer& operator<<(T);
+    void append_padded(unsigned, std::size_t);
+    std::string_view view(void) const;
+    void clear(void);
+    bool write_to(int) const;
+};
+
+/**
+ * Write an integer.
+ *
+ * @param value Integer.
+ *
+ * @return This buffer.
+ */
+template <typename T, typename> OutputBuffer& OutputBuffer::operator<<(T value)
+{
+    std::to_chars_result result = std::to_chars(this->data + this->size, this->data + CAPACITY, value);
+    if (result.ec == std::errc())
+    {
+        this->size = result.ptr - this->data;
+    }
+    return *this;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include "disk_cache.hh"
+#include "git_status.hh"
+#include "json_logger.hh"
+#include "prefetch_cache.hh"
+
+static JSONLogger logger;
+
+static char const PREFETCH_CACHE_MAGIC[] = "custom-prompt-prefetch 1";
+
+// Seconds for which prefetched information is used. Files modified in place
+// are not noticed, so it is meant only for the prompts shortly after changing
+// directories.
+static std::time_t constexpr PREFETCH_CACHE_LIFETIME = 60;
+
+/**
+ * Prepare to cache the Git information of the given Git repository. It is
+ * considered valid only if HEAD, the index and the exclude file are unchanged.
+ *
+ * @param repo Git repository.
+ */
+PrefetchCache::PrefetchCache(C::git_repository* repo)
+{
+    std::filesystem::path gitdir = C::git_repository_path(repo);
+    std::filesystem::path commondir = C::git_repository_commondir(repo);
+    C::git_oid oid;
+    std::error_code ec;
+    std::ostringstream fingerprint_stream;
+    fingerprint_stream << gitdir.string() << ' '
+                       << (C::git_reference_name_to_id(&oid, repo, "HEAD") == 0 ? C::git_oid_tostr_s(&oid) : "none");
+    fingerprint_stream << ' ' << modification_time(gitdir / "index") << ' '
+                       << std::filesystem::file_size(gitdir / "index", ec);
+    fingerprint_stream << ' ' << modification_time(gitdir / "HEAD") << ' '
+                       << modification_time(commondir / "info/exclude");
+    StatusLimits status_limits;
+    fingerprint_stream << ' ' << status_limits.dirty << ' ' << status_limits.staged << ' ' << status_limits.untracked;
+    this->fingerprint = fingerprint_stream.str();
+    this->path = cache_file_path("prefetch", gitdir.string());
+}
+
+/**
+ * Read the cached Git information if it is valid.
+ *
+ * @param information Git information.
+ *
+ * @return Whether valid information was found. If not, the argument is not
+ * modified.
+ */
+bool PrefetchCache::load(std::string& information) const
+{
+    if (this->path.empty())
+    {
+        return false;
+    }
+    std::ifstream cache_file(this->path);
+    std::string magic, fingerprint, cached_information;
+    std::time_t created;
+    if (!std::getline(cache_file, magic) || magic != PREFETCH_CACHE_MAGIC || !std::getline(cache_file, fingerprint)
+        || fingerprint != this->fingerprint || !(cache_file >> created) || cache_file.get() != '\n'
+        || !std::getline(cache_file, cached_information))
+    {
+        return false;
+    }
+    std::time_t now = std::time(nullptr);
+    if (created > now || now - created >= PREFETCH_CACHE_LIFETIME)
+    {
+        LOG_DEBUG(logger, "Prefetched information expired", "created", created, "now", now);
+        return false;
+    }
+    information = std::move(cached_information);
+    LOG_DEBUG(logger, "Using prefetched information", "path", this->path.string());
+    return true;
+}
+
+/**
+ * Cache the given Git information.
+ *
+ * @param information Git information.
+ */
+void PrefetchCache::store(std::string const& information) const
+{
+    if (this->path.empty())
+    {
+        return;
+    }
+    std::ostringstream cache_stream;
+    cache_stream << PREFETCH_CACHE_MAGIC << '\n'
+                 << this->fingerprint << '\n'
+                 << std::time(nullptr) << '\n'
+                 << information << '\n';
+    replace_file_contents(this->path, cache_stream.str());
+}
@@ -0,0 +1,26 @@
+#ifndef PREFETCH_CACHE_HH_
+#define PREFETCH_CACHE_HH_
+
+#include <filesystem>
+#include <string>
+
+#include "libgit2.hh"
+
+/**
+ * Remember the Git information obtained in advance (when the shell changes
+ * directories) for a Git repository, so that a prompt which cannot wait for
+ * the information need not go without it.
+ */
+class PrefetchCache
+{
+private:
+    std::filesystem::path path;
+    std::string fingerprint;
+
+public:
+    PrefetchCache(C::git_repository*);
+    bool load(std::string&) const;
+    void store(std::string const&) const;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef PROMPT_LAYOUT_HH_
+#define PROMPT_LAYOUT_HH_
+
+#include <cstddef>
+#include <string_view>
+
+#include "output_buffer.hh"
+
+/**
+ * String whose length is known at compile time, so that it can be
+ * concatenated with others at compile time.
+ */
+template <std::size_t N> class StaticString
+{
+private:
+    char data[N + 1];
+
+public:
+    constexpr StaticString(void);
+    constexpr StaticString(char const (&)[N + 1]);
+    template <std::size_t M> constexpr void assign(std::size_t&, StaticString<M> const&);
+    constexpr std::string_view view(void) const;
+};
+
+template <std::size_t N> StaticString(char const (&)[N]) -> StaticString<N - 1>;
+
+/**
+ * Prepare an empty string of the given length, to be filled in later.
+ */
+template <std::size_t N> constexpr StaticString<N>::StaticString(void) : data{}
+{
+}
+
+/**
+ * Copy a string literal.
+ *
+ * @param literal String literal.
+ */
+template <std::size_t N> constexpr StaticString<N>::StaticString(char const (&literal)[N + 1]) : data{}
+{
+    for (std::size_t i = 0; i < N; ++i)
+    {
+        this->data[i] = literal[i];
+    }
+}
+
+/**
+ * Overwrite a part of this string.
+ *
+ * @param position Position to start overwriting at. Updated to the position
+ * right after the part overwritten.
+ * @param part String to overwrite with.
+ */
+template <std::size_t N>
+template <std::size_t M>
+constexpr void StaticString<N>::assign(std::size_t& position, StaticString<M> const& part)
+{
+    std::string_view part_view = part.view();
+    for (std::size_t i = 0; i < M; ++i)
+    {
+        this->data[position++] = part_view[i];
+    }
+}
+
+/**
+ * Obtain the string.
+ *
+ * @return String.
+ */
+template <std::size_t N> constexpr std::string_view StaticString<N>::view(void) const
+{
+    return std::string_view(this->data, N);
+}
+
+/**
+ * Concatenate strings at compile time.
+ *
+ * @param parts Strings.
+ *
+ * @return Concatenated string.
+ */
+template <std::size_t... N> constexpr StaticString<(N + ... + 0)> concatenate(StaticString<N> const&... parts)
+{
+    StaticString<(N + ... + 0)> result;
+    std::size_t position = 0;
+    (result.assign(position, parts), ...);
+    return result;
+}
+
+/**
+ * Line of the prompt made up of the given segments, which are shown in the
+ * given order, separated by the given separator. Which segments are shown is
+ * decided when the prompt is rendered; everything else is decided at compile
+ * time, so rendering the line amounts to a few checks and copies.
+ *
+ * The separator is a type with a static string `value`. Each segment is a type
+ * with the static strings `prefix` and `suffix` (written before and after the
+ * variable part of the segment), and the static functions `is_shown` (which
+ * tells whether the segment should be shown for the given context) and
+ * `render` (which writes the variable part of the segment).
+ */
+template <typename Separator, typename... Segments> class PromptLine
+{
+public:
+    template <typename Context> static void render(OutputBuffer&, Context const&);
+
+private:
+    template <typename Segment> static constexpr auto SEPARATED_PREFIX
+        = concatenate(Separator::value, Segment::prefix);
+    template <typename Segment, typename Context> static void render_segment(OutputBuffer&, Context const&, bool&);
+};
+
+/**
+ * Write the segments to be shown.
+ *
+ * @param output_buffer Output buffer to write the line (without a line break)
+ * to.
+ * @param context Information shown in the prompt.
+ */
+template <typename Separator, typename... Segments>
+template <typename Context>
+void PromptLine<Separator, Segments...>::render(OutputBuffer& output_buffer, Context const& context)
+{
+    bool first = true;
+    (render_segment<Segments>(output_buffer, context, first), ...);
+}
+
+/**
+ * Write a segment, if it is to be shown.
+ *
+ * @param output_buffer Output buffer to write the segment to.
+ * @param context Information shown in the prompt.
+ * @param first Whether no segment has been written yet. Updated if this one is
+ * written.
+ */
+template <typename Separator, typename... Segments>
+template <typename Segment, typename Context>
+void PromptLine<Separator, Segments...>::render_segment(
+    OutputBuffer& output_buffer, Context const& context, bool& first
+)
+{
+    if (!Segment::is_shown(context))
+    {
+        return;
+    }
+    output_buffer << (first ? Segment::prefix.view() : SEPARATED_PREFIX<Segment>.view());
+    first = false;
+    Segment::render(output_buffer, context);
+    if constexpr (!Segment::suffix.view().empty())
+    {
+        output_buffer << Segment::suffix.view();
+    }
+}
+
+#endif
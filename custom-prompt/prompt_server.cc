@@ -0,0 +1,206 @@
+#include <cstdlib>
+#include <string>
+
+#include "json_logger.hh"
+#include "prompt_server.hh"
+
+static JSONLogger logger;
+
+#ifdef _WIN32
+
+int run_prompt_server(std::string const& socket_path, PromptServerHooks const& hooks)
+{
+    return EXIT_FAILURE;
+}
+
+#else
+
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "prompt_socket.hh"
+
+extern char** environ;
+
+/**
+ * Check whether the peer of the given connection is run by the same user as
+ * this process. Anyone else must not be able to make us write to arbitrary
+ * file descriptors.
+ *
+ * @param conn Connected socket.
+ *
+ * @return Whether the users match.
+ */
+static bool peer_is_trusted(int conn)
+{
+#ifdef __linux__
+    ucred credentials;
+    socklen_t credentials_size = sizeof credentials;
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_size) != 0)
+    {
+        return false;
+    }
+    return credentials.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(conn, &uid, &gid) != 0)
+    {
+        return false;
+    }
+    return uid == geteuid();
+#endif
+}
+
+/**
+ * Serve a single request in a child process, which inherits everything the
+ * server has prepared (most notably, open Git repositories) and takes the
+ * place of the program the client would have run.
+ *
+ * @param conn Connected socket. The exit code is written to it.
+ * @param request Request to serve.
+ * @param handler Actual entry point of the program.
+ */
+[[noreturn]] static void serve_prompt_request(int conn, PromptRequest& request, int (*handler)(int, char const*[]))
+{
+    std::signal(SIGCHLD, SIG_DFL);
+    std::signal(SIGPIPE, SIG_DFL);
+    for (int i = 0; i < 3; ++i)
+    {
+        dup2(request.fds[i], i);
+        if (request.fds[i] > 2)
+        {
+            close(request.fds[i]);
+        }
+    }
+    if (chdir(request.directory.data()) != 0)
+    {
+        std::_Exit(EXIT_FAILURE);
+    }
+
+    std::vector<char*> envp;
+    for (std::string& env : request.environment)
+    {
+        envp.push_back(env.data());
+    }
+    envp.push_back(nullptr);
+    environ = envp.data();
+    std::vector<char const*> argv;
+    for (std::string const& argument : request.arguments)
+    {
+        argv.push_back(argument.data());
+    }
+    argv.push_back(nullptr);
+
+    int exit_code = handler(argv.size() - 1, argv.data());
+    std::cout.flush();
+    std::clog.flush();
+    char exit_code_byte = exit_code;
+    write(conn, &exit_code_byte, 1);
+    std::exit(exit_code);
+}
+
+/**
+ * Listen for prompt requests indefinitely. Each request is served in a child
+ * process forked from this one, which means that anything done in this
+ * process to speed up serving a request is inherited by all subsequent
+ * requests.
+ *
+ * @param socket_path Path of the Unix domain socket to listen on.
+ * @param hooks Functions through which requests are served.
+ *
+ * @return Exit code.
+ */
+int run_prompt_server(std::string const& socket_path, PromptServerHooks const& hooks)
+{
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof address.sun_path)
+    {
+        return EXIT_FAILURE;
+    }
+    std::strcpy(address.sun_path, socket_path.data());
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // If another server is already listening, let it be.
+    if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof address) == 0)
+    {
+        LOG_DEBUG(logger, "Server already running", "socket_path", socket_path);
+        close(sock);
+        return EXIT_SUCCESS;
+    }
+    unlink(socket_path.data());
+    umask(0077);
+    if (bind(sock, reinterpret_cast<sockaddr*>(&address), sizeof address) != 0 || listen(sock, 16) != 0)
+    {
+        close(sock);
+        return EXIT_FAILURE;
+    }
+    LOG_DEBUG(logger, "Listening", "socket_path", socket_path);
+
+    // Children need not be waited for.
+    std::signal(SIGCHLD, SIG_IGN);
+    std::signal(SIGPIPE, SIG_IGN);
+    while (true)
+    {
+        std::vector<pollfd> pollfds = { { sock, POLLIN, 0 } };
+        for (int fd : hooks.get_fds())
+        {
+            pollfds.push_back({ fd, POLLIN, 0 });
+        }
+        if (poll(pollfds.data(), pollfds.size(), -1) <= 0)
+        {
+            continue;
+        }
+        for (std::size_t i = 1; i < pollfds.size(); ++i)
+        {
+            if (pollfds[i].revents & POLLIN)
+            {
+                hooks.process(pollfds[i].fd);
+            }
+        }
+        if (!(pollfds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        int conn = accept(sock, nullptr, nullptr);
+        if (conn < 0)
+        {
+            continue;
+        }
+        PromptRequest request;
+        if (!peer_is_trusted(conn) || !receive_prompt_request(conn, request))
+        {
+            close(conn);
+            continue;
+        }
+        LOG_DEBUG(logger, "Received request", "directory", request.directory, "arguments", request.arguments.size());
+        hooks.prepare(request.directory.data());
+        if (fork() == 0)
+        {
+            close(sock);
+            serve_prompt_request(conn, request, hooks.handler);
+        }
+        for (int fd : request.fds)
+        {
+            close(fd);
+        }
+        close(conn);
+    }
+}
+
+#endif
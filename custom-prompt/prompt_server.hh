@@ -0,0 +1,25 @@
+#ifndef PROMPT_SERVER_HH_
+#define PROMPT_SERVER_HH_
+
+#include <string>
+#include <vector>
+
+/**
+ * Functions through which the server does its work.
+ */
+struct PromptServerHooks
+{
+    // Actual entry point of the program.
+    int (*handler)(int, char const*[]);
+    // Called in the server process with the directory of each request before
+    // forking.
+    void (*prepare)(char const*);
+    // Obtain file descriptors to wait on in addition to the socket, and
+    // process one of them once it becomes readable.
+    std::vector<int> (*get_fds)(void);
+    void (*process)(int);
+};
+
+int run_prompt_server(std::string const&, PromptServerHooks const&);
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef _WIN32
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "prompt_socket.hh"
+
+/**
+ * Obtain the path of the Unix domain socket a server with the given name
+ * listens on. It is placed in the runtime directory of the user if there is
+ * one, because that is accessible only to the user.
+ *
+ * @param name Server name.
+ *
+ * @return Socket path.
+ */
+std::string prompt_socket_path(char const* name)
+{
+    char const* runtime_directory = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime_directory != nullptr && runtime_directory[0] != '\0')
+    {
+        return std::string(runtime_directory) + '/' + name + ".sock";
+    }
+    return std::string("/tmp/") + name + '-' + std::to_string(getuid()) + ".sock";
+}
+
+/**
+ * Write all of the given bytes to a file descriptor.
+ *
+ * @param fd File descriptor.
+ * @param data Bytes to write.
+ * @param size Number of bytes to write.
+ *
+ * @return Whether all bytes were written.
+ */
+static bool write_fully(int fd, char const* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t count = write(fd, data, size);
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+/**
+ * Read exactly the given number of bytes from a file descriptor.
+ *
+ * @param fd File descriptor.
+ * @param data Buffer to read into.
+ * @param size Number of bytes to read.
+ *
+ * @return Whether all bytes were read.
+ */
+static bool read_fully(int fd, char* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t count = read(fd, data, size);
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+/**
+ * Send a prompt request to a server. The request consists of a 4-byte length
+ * followed by null-terminated strings: the current directory, the command line
+ * arguments, an empty string and the environment variables. Standard input,
+ * standard output and standard error are passed along with the length, so
+ * that the server can write to the terminal and to the shell directly.
+ *
+ * @param sock Connected socket.
+ * @param argc Number of command line arguments.
+ * @param argv Command line arguments.
+ * @param envp Environment variables.
+ *
+ * @return Whether the request was sent.
+ */
+bool send_prompt_request(int sock, int argc, char const* const argv[], char const* const envp[])
+{
+    std::string payload;
+    char directory[4096];
+    if (getcwd(directory, sizeof directory / sizeof *directory) == nullptr)
+    {
+        return false;
+    }
+    payload.append(directory).push_back('\0');
+    for (int i = 0; i < argc; ++i)
+    {
+        payload.append(argv[i]).push_back('\0');
+    }
+    payload.push_back('\0');
+    for (char const* const* env = envp; *env != nullptr; ++env)
+    {
+        payload.append(*env).push_back('\0');
+    }
+
+    std::uint32_t payload_size = payload.size();
+    iovec iov = { &payload_size, sizeof payload_size };
+    int fds[] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof fds)];
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+    if (sendmsg(sock, &msg, 0) != sizeof payload_size)
+    {
+        return false;
+    }
+    return write_fully(sock, payload.data(), payload.size());
+}
+
+/**
+ * Receive a prompt request from a client.
+ *
+ * @param conn Connected socket.
+ * @param request Request to fill in. Its file descriptors are owned by the
+ * caller if this function succeeds.
+ *
+ * @return Whether a well-formed request was received.
+ */
+bool receive_prompt_request(int conn, PromptRequest& request)
+{
+    std::uint32_t payload_size;
+    iovec iov = { &payload_size, sizeof payload_size };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof request.fds)];
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if (recvmsg(conn, &msg, 0) != sizeof payload_size)
+    {
+        return false;
+    }
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof request.fds))
+    {
+        return false;
+    }
+    std::memcpy(request.fds, CMSG_DATA(cmsg), sizeof request.fds);
+
+    // Guard against garbage. Nothing legitimate comes anywhere close to this
+    // size.
+    std::string payload;
+    if (payload_size <= (1U << 20))
+    {
+        payload.resize(payload_size);
+    }
+    if (payload.empty() || !read_fully(conn, payload.data(), payload.size()))
+    {
+        for (int fd : request.fds)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    std::vector<std::string>* destination = &request.arguments;
+    std::size_t begin = payload.find('\0');
+    request.directory = payload.substr(0, begin);
+    while (begin != std::string::npos && ++begin < payload.size())
+    {
+        std::size_t end = payload.find('\0', begin);
+        if (end == begin && destination == &request.arguments)
+        {
+            destination = &request.environment;
+        }
+        else
+        {
+            destination->push_back(payload.substr(begin, end - begin));
+        }
+        begin = end;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef PROMPT_SOCKET_HH_
+#define PROMPT_SOCKET_HH_
+
+#include <string>
+#include <vector>
+
+/**
+ * Everything a prompt server needs to know in order to behave exactly as the
+ * program would have, had the client run it directly.
+ */
+struct PromptRequest
+{
+    std::string directory;
+    std::vector<std::string> arguments;
+    std::vector<std::string> environment;
+    // Standard input, standard output and standard error of the client.
+    int fds[3];
+};
+
+std::string prompt_socket_path(char const*);
+bool send_prompt_request(int, int, char const* const[], char const* const[]);
+bool receive_prompt_request(int, PromptRequest&);
+
+#endif
@@ -0,0 +1,187 @@
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <string>
+
+#include "json_logger.hh"
+#include "log_sink.hh"
+#include "prompt_worker.hh"
+
+static JSONLogger logger;
+
+// Verdicts the parent sends the child once it is done waiting.
+static char constexpr VERDICT_ACCEPTED = 'A';
+static char constexpr VERDICT_GAVE_UP = 'G';
+
+/**
+ * Check whether the prompt should be redrawn asynchronously. This is enabled
+ * only if the environment variable `CUSTOM_PROMPT_ASYNC` is set to a non-zero
+ * number. (On Zsh, `CUSTOM_PROMPT_ASYNC_FIFO` must also be set to the FIFO the
+ * shell reads redrawn prompts from; see `.zshrc`.)
+ *
+ * @return Whether asynchronous redrawing is enabled.
+ */
+bool PromptWorker::is_enabled(void)
+{
+#ifdef _WIN32
+    return false;
+#else
+    char const* async_env = std::getenv("CUSTOM_PROMPT_ASYNC");
+    return async_env != nullptr && std::atoi(async_env) != 0;
+#endif
+}
+
+/**
+ * Prepare a worker which has not started.
+ */
+PromptWorker::PromptWorker(void) : sock(-1)
+{
+}
+
+/**
+ * Check whether the worker has started.
+ *
+ * @return Whether the worker has started.
+ */
+bool PromptWorker::is_running(void) const
+{
+    return this->sock >= 0;
+}
+
+#ifdef _WIN32
+
+bool PromptWorker::start(
+    std::function<std::string(void)> const& compute, std::function<void(std::string const&)> const& deliver,
+    std::promise<std::string>& promise
+)
+{
+    return false;
+}
+
+void PromptWorker::settle(bool accepted)
+{
+}
+
+#else
+
+#include <csignal>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * Start computing in a child process. This must be called while the calling
+ * process has only one thread, because only the calling thread is present in
+ * the child.
+ *
+ * @param compute Function computing the result. Called in the child.
+ * @param deliver Function delivering the result to the shell if the parent
+ * gave up on it. Called in the child.
+ * @param promise Promise to fulfil with the result in the parent. It is moved
+ * from only if the worker is started.
+ *
+ * @return Whether the worker was started.
+ */
+bool PromptWorker::start(
+    std::function<std::string(void)> const& compute, std::function<void(std::string const&)> const& deliver,
+    std::promise<std::string>& promise
+)
+{
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) != 0)
+    {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(socks[0]);
+        close(socks[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        // The shell waits for standard output to be closed before drawing the
+        // prompt. Don't hold it up.
+        close(socks[0]);
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+        std::string result = compute();
+
+        // If the parent has given up already, it has not read the result, and
+        // may have exited, so that writing would fail. Check first, but also
+        // tolerate the write failing (instead of being killed), because the
+        // verdict may arrive while writing.
+        std::signal(SIGPIPE, SIG_IGN);
+        char verdict;
+        if (recv(socks[1], &verdict, 1, MSG_DONTWAIT) != 1)
+        {
+            for (std::size_t written = 0; written < result.size();)
+            {
+                ssize_t count = write(socks[1], result.data() + written, result.size() - written);
+                if (count <= 0)
+                {
+                    break;
+                }
+                written += count;
+            }
+            shutdown(socks[1], SHUT_WR);
+            if (read(socks[1], &verdict, 1) != 1)
+            {
+                verdict = VERDICT_ACCEPTED;
+            }
+        }
+        if (verdict == VERDICT_GAVE_UP)
+        {
+            LOG_DEBUG(logger, "Delivering result asynchronously", "bytes", result.size());
+            deliver(result);
+        }
+        LogSink::flush();
+        std::_Exit(EXIT_SUCCESS);
+    }
+
+    close(socks[1]);
+    this->sock = socks[0];
+    LOG_DEBUG(logger, "Started worker", "pid", pid);
+    std::thread(
+        [](int sock, std::promise<std::string> promise)
+        {
+            std::string result;
+            char buf[4096];
+            ssize_t count;
+            while ((count = read(sock, buf, sizeof buf / sizeof *buf)) > 0)
+            {
+                result.append(buf, count);
+            }
+            promise.set_value(std::move(result));
+        },
+        this->sock, std::move(promise)
+    )
+        .detach();
+    return true;
+}
+
+/**
+ * Tell the child whether its result was used. If it wasn't, the child will
+ * deliver it on its own.
+ *
+ * @param accepted Whether the result was used.
+ */
+void PromptWorker::settle(bool accepted)
+{
+    if (this->sock < 0)
+    {
+        return;
+    }
+    char verdict = accepted ? VERDICT_ACCEPTED : VERDICT_GAVE_UP;
+    write(this->sock, &verdict, 1);
+}
+
+#endif
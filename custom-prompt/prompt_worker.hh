@@ -0,0 +1,30 @@
+#ifndef PROMPT_WORKER_HH_
+#define PROMPT_WORKER_HH_
+
+#include <functional>
+#include <future>
+#include <string>
+
+/**
+ * Compute part of the prompt in a child process. If the parent waits for the
+ * result, it is handed over as usual. If the parent gives up on it (because it
+ * is taking too long), the child delivers it to the shell on its own once it
+ * is ready, so that the prompt can be redrawn.
+ */
+class PromptWorker
+{
+private:
+    int sock;
+
+public:
+    PromptWorker(void);
+    bool start(
+        std::function<std::string(void)> const&, std::function<void(std::string const&)> const&,
+        std::promise<std::string>&
+    );
+    bool is_running(void) const;
+    void settle(bool);
+    static bool is_enabled(void);
+};
+
+#endif
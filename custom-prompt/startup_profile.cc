@@ -0,0 +1,89 @@
+#include <cstddef>
+#include <cstdio>
+#include <ctime>
+
+#ifdef __linux__
+#include <link.h>
+#endif
+
+#include "startup_profile.hh"
+
+/**
+ * Times (in nanoseconds) at some points during startup, as measured by a
+ * process CPU-time clock and a monotonic clock.
+ */
+struct StartupTimes
+{
+    long long cpu, wall;
+};
+
+static StartupTimes first_initialiser_times, main_times;
+
+/**
+ * Read the clocks.
+ *
+ * @return Times.
+ */
+static StartupTimes read_startup_times(void)
+{
+    std::timespec cpu_ts = {}, wall_ts = {};
+#ifndef _WIN32
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_ts);
+    clock_gettime(CLOCK_MONOTONIC, &wall_ts);
+#endif
+    return { cpu_ts.tv_sec * 1'000'000'000LL + cpu_ts.tv_nsec, wall_ts.tv_sec * 1'000'000'000LL + wall_ts.tv_nsec };
+}
+
+/**
+ * Record the times before any other static initialiser of this program runs.
+ * By then, the dynamic loader has loaded and relocated all shared libraries
+ * and run their initialisers.
+ */
+__attribute__((constructor(101))) static void record_startup_first_initialiser(void)
+{
+    first_initialiser_times = read_startup_times();
+}
+
+/**
+ * Record the times on entering `main`, after all static initialisers have run.
+ */
+void record_startup_main(void)
+{
+    main_times = read_startup_times();
+}
+
+#ifdef __linux__
+/**
+ * Show the name of a loaded shared object.
+ *
+ * @param info Shared object.
+ *
+ * @return 0, to continue iterating.
+ */
+static int print_shared_object(dl_phdr_info* info, std::size_t, void*)
+{
+    if (info->dlpi_name != nullptr && *info->dlpi_name != '\0')
+    {
+        std::printf("  %s\n", info->dlpi_name);
+    }
+    return 0;
+}
+#endif
+
+/**
+ * Show how much time was spent starting this program. The CPU time of this
+ * process before the first static initialiser ran is attributed to the dynamic
+ * loader (it also includes the small amount spent executing the program).
+ * Wall-clock time is not available for it, because the time at which the
+ * process started is not known precisely.
+ */
+void print_startup_profile(void)
+{
+    std::printf("dynamic loader (CPU):       %9.1f µs\n", first_initialiser_times.cpu / 1000.0);
+    std::printf("static initialisers (CPU):  %9.1f µs\n", (main_times.cpu - first_initialiser_times.cpu) / 1000.0);
+    std::printf("static initialisers (wall): %9.1f µs\n", (main_times.wall - first_initialiser_times.wall) / 1000.0);
+#ifdef __linux__
+    std::printf("shared objects loaded:\n");
+    dl_iterate_phdr(print_shared_object, nullptr);
+#endif
+}
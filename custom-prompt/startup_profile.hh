@@ -0,0 +1,7 @@
+#ifndef STARTUP_PROFILE_HH_
+#define STARTUP_PROFILE_HH_
+
+void record_startup_main(void);
+void print_startup_profile(void);
+
+#endif
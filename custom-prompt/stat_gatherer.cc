@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "json_logger.hh"
+#include "stat_gatherer.hh"
+#include "thread_pool.hh"
+#include "trace_span.hh"
+
+static JSONLogger logger;
+
+#ifdef __APPLE__
+#define ST_CTIM st_ctimespec
+#define ST_MTIM st_mtimespec
+#else
+#define ST_CTIM st_ctim
+#define ST_MTIM st_mtim
+#endif
+
+// Files examined at a time by a thread. Fewer are not worth handing over.
+static std::size_t constexpr FILES_PER_THREAD = 256;
+
+/**
+ * Choose how stat data are obtained. If the environment variable
+ * `CUSTOM_PROMPT_IO_URING` is set to a non-zero number, io_uring is used (if
+ * the kernel allows it). Otherwise, the files are spread across as many
+ * threads as `CUSTOM_PROMPT_STATUS_THREADS` says.
+ */
+StatGatherer::StatGatherer(void) :
+    threads(1)
+#ifdef __linux__
+    ,
+    ring_fd(-1), submission_ring(nullptr), completion_ring(nullptr), submission_ring_size(0),
+    completion_ring_size(0), submission_entries(nullptr), completion_entries(nullptr)
+#endif
+{
+#ifdef __linux__
+    char const* io_uring_env = std::getenv("CUSTOM_PROMPT_IO_URING");
+    if (io_uring_env != nullptr && std::atoi(io_uring_env) != 0)
+    {
+        if (!this->set_up_ring())
+        {
+            this->start_threads(true);
+        }
+        return;
+    }
+#endif
+    this->start_threads(false);
+}
+
+/**
+ * Release the ring, if any.
+ */
+StatGatherer::~StatGatherer()
+{
+#ifdef __linux__
+    this->tear_down_ring();
+#endif
+}
+
+/**
+ * Obtain the stat data of files.
+ *
+ * @param paths Paths of the files. Null pointers are skipped.
+ * @param file_stats Stat data, in the same order as the paths.
+ */
+void StatGatherer::gather(std::vector<char const*> const& paths, std::vector<FileStat>& file_stats)
+{
+    TraceSpan trace_span(__func__);
+    file_stats.resize(paths.size());
+#ifdef __linux__
+    if (this->ring_fd >= 0)
+    {
+        if (this->gather_with_ring(paths, file_stats))
+        {
+            return;
+        }
+        LOG_DEBUG(logger, "Stat data could not be obtained through io_uring");
+        this->tear_down_ring();
+        this->start_threads(true);
+    }
+#endif
+    this->gather_with_threads(paths, file_stats);
+}
+
+/**
+ * Start the threads among which files are split. When falling back from
+ * io_uring, use one per core unless `CUSTOM_PROMPT_STATUS_THREADS` is set.
+ *
+ * @param fallback Whether io_uring was asked for but cannot be used.
+ */
+void StatGatherer::start_threads(bool fallback)
+{
+    if (fallback && std::getenv("CUSTOM_PROMPT_STATUS_THREADS") == nullptr)
+    {
+        this->threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    else
+    {
+        this->threads = ThreadPool::default_size("CUSTOM_PROMPT_STATUS_THREADS");
+    }
+    if (this->threads > 1)
+    {
+        this->thread_pool = std::make_unique<ThreadPool>(this->threads);
+    }
+}
+
+/**
+ * Obtain the stat data of files, splitting them among the threads (or not, if
+ * there are too few of either).
+ *
+ * @param paths Paths of the files. Null pointers are skipped.
+ * @param file_stats Stat data, in the same order as the paths.
+ */
+void StatGatherer::gather_with_threads(std::vector<char const*> const& paths, std::vector<FileStat>& file_stats)
+{
+    std::size_t slices = std::min(this->threads, (paths.size() + FILES_PER_THREAD - 1) / FILES_PER_THREAD);
+    if (this->thread_pool == nullptr || slices <= 1)
+    {
+        for (std::size_t i = 0; i < paths.size(); ++i)
+        {
+            StatGatherer::stat_file(paths[i], file_stats[i]);
+        }
+        return;
+    }
+    std::vector<std::future<void>> futures;
+    std::size_t slice_size = (paths.size() + slices - 1) / slices;
+    for (std::size_t begin = 0; begin < paths.size(); begin += slice_size)
+    {
+        std::size_t end = std::min(begin + slice_size, paths.size());
+        futures.push_back(this->thread_pool->submit(
+            [&paths, &file_stats, begin, end]
+            {
+                for (std::size_t i = begin; i < end; ++i)
+                {
+                    StatGatherer::stat_file(paths[i], file_stats[i]);
+                }
+            }
+        ));
+    }
+    for (std::future<void>& future : futures)
+    {
+        future.wait();
+    }
+}
+
+/**
+ * Obtain the stat data of a file.
+ *
+ * @param path Path of the file, or a null pointer.
+ * @param file_stat Stat data to fill in.
+ */
+void StatGatherer::stat_file(char const* path, FileStat& file_stat)
+{
+    file_stat.mode = 0;
+#ifndef _WIN32
+    struct stat st;
+    if (path == nullptr || lstat(path, &st) != 0)
+    {
+        return;
+    }
+    file_stat.ctime_seconds = st.ST_CTIM.tv_sec;
+    file_stat.ctime_nanoseconds = st.ST_CTIM.tv_nsec;
+    file_stat.mtime_seconds = st.ST_MTIM.tv_sec;
+    file_stat.mtime_nanoseconds = st.ST_MTIM.tv_nsec;
+    file_stat.ino = st.st_ino;
+    file_stat.size = st.st_size;
+    file_stat.mode = st.st_mode;
+    file_stat.uid = st.st_uid;
+    file_stat.gid = st.st_gid;
+#endif
+}
+
+#ifdef __linux__
+
+/**
+ * Create an io_uring instance, and map its rings into memory.
+ *
+ * @return Whether the ring is ready.
+ */
+bool StatGatherer::set_up_ring(void)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof params);
+    int ring_fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ring_fd < 0)
+    {
+        LOG_DEBUG(logger, "io_uring is not available", "errno", errno);
+        return false;
+    }
+    this->ring_fd = ring_fd;
+    this->submission_ring_size = params.sq_off.array + params.sq_entries * sizeof(std::uint32_t);
+    this->completion_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mapping = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mapping)
+    {
+        this->submission_ring_size = this->completion_ring_size
+            = std::max(this->submission_ring_size, this->completion_ring_size);
+    }
+    int constexpr protection = PROT_READ | PROT_WRITE;
+    int constexpr flags = MAP_SHARED | MAP_POPULATE;
+    void* submission_ring = mmap(nullptr, this->submission_ring_size, protection, flags, ring_fd, IORING_OFF_SQ_RING);
+    if (submission_ring == MAP_FAILED)
+    {
+        this->tear_down_ring();
+        return false;
+    }
+    this->submission_ring = submission_ring;
+    void* completion_ring = single_mapping
+        ? submission_ring
+        : mmap(nullptr, this->completion_ring_size, protection, flags, ring_fd, IORING_OFF_CQ_RING);
+    if (completion_ring == MAP_FAILED)
+    {
+        this->tear_down_ring();
+        return false;
+    }
+    this->completion_ring = completion_ring;
+    void* submission_entries
+        = mmap(nullptr, RING_ENTRIES * sizeof(io_uring_sqe), protection, flags, ring_fd, IORING_OFF_SQES);
+    if (submission_entries == MAP_FAILED)
+    {
+        this->tear_down_ring();
+        return false;
+    }
+    this->submission_entries = static_cast<io_uring_sqe*>(submission_entries);
+
+    char* submission_base = static_cast<char*>(submission_ring);
+    this->submission_head = reinterpret_cast<std::uint32_t*>(submission_base + params.sq_off.head);
+    this->submission_tail = reinterpret_cast<std::uint32_t*>(submission_base + params.sq_off.tail);
+    this->submission_mask = reinterpret_cast<std::uint32_t*>(submission_base + params.sq_off.ring_mask);
+    this->submission_array = reinterpret_cast<std::uint32_t*>(submission_base + params.sq_off.array);
+    char* completion_base = static_cast<char*>(completion_ring);
+    this->completion_head = reinterpret_cast<std::uint32_t*>(completion_base + params.cq_off.head);
+    this->completion_tail = reinterpret_cast<std::uint32_t*>(completion_base + params.cq_off.tail);
+    this->completion_mask = reinterpret_cast<std::uint32_t*>(completion_base + params.cq_off.ring_mask);
+    this->completion_entries = reinterpret_cast<io_uring_cqe*>(completion_base + params.cq_off.cqes);
+    LOG_DEBUG(logger, "Set up io_uring", "entries", params.sq_entries);
+    return true;
+}
+
+/**
+ * Unmap the rings and close the io_uring instance, if any.
+ */
+void StatGatherer::tear_down_ring(void)
+{
+    if (this->submission_entries != nullptr)
+    {
+        munmap(this->submission_entries, RING_ENTRIES * sizeof(io_uring_sqe));
+        this->submission_entries = nullptr;
+    }
+    if (this->completion_ring != nullptr && this->completion_ring != this->submission_ring)
+    {
+        munmap(this->completion_ring, this->completion_ring_size);
+    }
+    this->completion_ring = nullptr;
+    if (this->submission_ring != nullptr)
+    {
+        munmap(this->submission_ring, this->submission_ring_size);
+        this->submission_ring = nullptr;
+    }
+    if (this->ring_fd >= 0)
+    {
+        close(this->ring_fd);
+        this->ring_fd = -1;
+    }
+}
+
+/**
+ * Obtain the stat data of files by keeping the ring full of `statx` requests.
+ * Requests are submitted in one system call, which then waits for half of
+ * those in flight to complete.
+ *
+ * @param paths Paths of the files. Null pointers are skipped.
+ * @param file_stats Stat data, in the same order as the paths.
+ *
+ * @return Whether the stat data were obtained. If not, the kernel may not
+ * support `statx` through io_uring.
+ */
+bool StatGatherer::gather_with_ring(std::vector<char const*> const& paths, std::vector<FileStat>& file_stats)
+{
+    // Each slot of the ring gets a buffer of its own, which stays in use until
+    // the request in it completes.
+    std::unique_ptr<struct statx[]> buffers(new struct statx[RING_ENTRIES]);
+    std::vector<std::size_t> free_slots(RING_ENTRIES);
+    for (unsigned slot = 0; slot < RING_ENTRIES; ++slot)
+    {
+        free_slots[slot] = RING_ENTRIES - 1 - slot;
+    }
+    std::size_t next = 0;
+    unsigned in_flight = 0;
+    bool supported = true;
+    while (true)
+    {
+        std::uint32_t tail = *this->submission_tail;
+        unsigned queued = 0;
+        for (; next < paths.size() && !free_slots.empty(); ++next)
+        {
+            if (paths[next] == nullptr)
+            {
+                file_stats[next].mode = 0;
+                continue;
+            }
+            std::size_t slot = free_slots.back();
+            free_slots.pop_back();
+            std::uint32_t index = tail & *this->submission_mask;
+            io_uring_sqe* entry = this->submission_entries + index;
+            std::memset(entry, 0, sizeof *entry);
+            entry->opcode = IORING_OP_STATX;
+            entry->fd = AT_FDCWD;
+            entry->addr = reinterpret_cast<std::uintptr_t>(paths[next]);
+            entry->len = STATX_BASIC_STATS;
+            entry->off = reinterpret_cast<std::uintptr_t>(buffers.get() + slot);
+            entry->statx_flags = AT_SYMLINK_NOFOLLOW;
+            // Remember both where the result goes and which buffer it is in.
+            entry->user_data = next * RING_ENTRIES + slot;
+            this->submission_array[index] = index;
+            ++tail;
+            ++queued;
+        }
+        __atomic_store_n(this->submission_tail, tail, __ATOMIC_RELEASE);
+        in_flight += queued;
+        if (in_flight == 0)
+        {
+            return supported;
+        }
+        unsigned to_submit = tail - __atomic_load_n(this->submission_head, __ATOMIC_ACQUIRE);
+        long entered = syscall(
+            __NR_io_uring_enter, this->ring_fd, to_submit, (in_flight - to_submit + 1) / 2, IORING_ENTER_GETEVENTS,
+            nullptr, 0
+        );
+        if (entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            LOG_DEBUG(logger, "Could not enter io_uring", "errno", errno);
+            if (in_flight > to_submit)
+            {
+                // The kernel may yet write to the buffers.
+                buffers.release();
+            }
+            return false;
+        }
+
+        std::uint32_t head = *this->completion_head;
+        std::uint32_t completion_tail = __atomic_load_n(this->completion_tail, __ATOMIC_ACQUIRE);
+        for (; head != completion_tail; ++head)
+        {
+            io_uring_cqe const* completion = this->completion_entries + (head & *this->completion_mask);
+            std::size_t i = completion->user_data / RING_ENTRIES;
+            std::size_t slot = completion->user_data % RING_ENTRIES;
+            struct statx const& buffer = buffers[slot];
+            FileStat& file_stat = file_stats[i];
+            free_slots.push_back(slot);
+            --in_flight;
+            if (completion->res == -EINVAL || completion->res == -EOPNOTSUPP)
+            {
+                supported = false;
+            }
+            if (completion->res < 0)
+            {
+                file_stat.mode = 0;
+                continue;
+            }
+            file_stat.ctime_seconds = buffer.stx_ctime.tv_sec;
+            file_stat.ctime_nanoseconds = buffer.stx_ctime.tv_nsec;
+            file_stat.mtime_seconds = buffer.stx_mtime.tv_sec;
+            file_stat.mtime_nanoseconds = buffer.stx_mtime.tv_nsec;
+            file_stat.ino = buffer.stx_ino;
+            file_stat.size = buffer.stx_size;
+            file_stat.mode = buffer.stx_mode;
+            file_stat.uid = buffer.stx_uid;
+            file_stat.gid = buffer.stx_gid;
+        }
+        __atomic_store_n(this->completion_head, head, __ATOMIC_RELEASE);
+        if (!supported)
+        {
+            // Stop submitting; only wait for what is in flight.
+            next = paths.size();
+        }
+    }
+}
+
+#endif
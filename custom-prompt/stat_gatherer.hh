@@ -0,0 +1,68 @@
+#ifndef STAT_GATHERER_HH_
+#define STAT_GATHERER_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "thread_pool.hh"
+
+#ifdef __linux__
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+/**
+ * Those parts of the stat data of a file which Git records in the index. The
+ * mode of a file which could not be examined is 0.
+ */
+struct FileStat
+{
+    std::int64_t ctime_seconds, ctime_nanoseconds, mtime_seconds, mtime_nanoseconds;
+    std::uint64_t ino, size;
+    std::uint32_t mode, uid, gid;
+};
+
+/**
+ * Obtain the stat data of many files at once (without following symbolic
+ * links). On Linux, the requests may be submitted in batches through io_uring,
+ * so that the kernel can serve them concurrently and a system call is not
+ * needed for every file. Otherwise, they are spread across threads.
+ */
+class StatGatherer
+{
+private:
+    // Requests in flight at a time.
+    static unsigned constexpr RING_ENTRIES = 256;
+    std::unique_ptr<ThreadPool> thread_pool;
+    std::size_t threads;
+#ifdef __linux__
+    int ring_fd;
+    void* submission_ring, *completion_ring;
+    std::size_t submission_ring_size, completion_ring_size;
+    io_uring_sqe* submission_entries;
+    io_uring_cqe* completion_entries;
+    std::uint32_t *submission_head, *submission_tail, *submission_mask, *submission_array;
+    std::uint32_t *completion_head, *completion_tail, *completion_mask;
+#endif
+
+public:
+    StatGatherer(void);
+    StatGatherer(StatGatherer const&) = delete;
+    StatGatherer& operator=(StatGatherer const&) = delete;
+    ~StatGatherer();
+    void gather(std::vector<char const*> const&, std::vector<FileStat>&);
+
+private:
+    void start_threads(bool);
+    void gather_with_threads(std::vector<char const*> const&, std::vector<FileStat>&);
+    static void stat_file(char const*, FileStat&);
+#ifdef __linux__
+    bool set_up_ring(void);
+    void tear_down_ring(void);
+    bool gather_with_ring(std::vector<char const*> const&, std::vector<FileStat>&);
+#endif
+};
+
+#endif
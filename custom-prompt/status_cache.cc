@@ -0,0 +1,174 @@
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+#include "disk_cache.hh"
+#include "git_status.hh"
+#include "index_file.hh"
+#include "json_logger.hh"
+#include "status_cache.hh"
+
+static JSONLogger logger;
+
+static char const STATUS_CACHE_MAGIC[] = "custom-prompt-status 1";
+
+/**
+ * Prepare to cache the statuses of the given Git repository. Caching is
+ * enabled only if the environment variable `CUSTOM_PROMPT_STATUS_CACHE_TTL`
+ * is set to a positive number of seconds.
+ *
+ * The cache is considered valid if HEAD, the index and the exclude file are
+ * unchanged, and the modification time of every directory containing tracked
+ * files (or containing untracked files) is unchanged. This catches files being
+ * created, deleted, renamed, staged and committed, but not files being
+ * modified in place, because that does not update the modification time of
+ * the directory. Hence, cached statuses are also considered valid only for the
+ * number of seconds mentioned above.
+ *
+ * @param repo Git repository.
+ * @param oid Object ID of the current commit, if any.
+ */
+StatusCache::StatusCache(C::git_repository* repo, C::git_oid const* oid) : repo(repo), ttl(0)
+{
+    char const* ttl_env = std::getenv("CUSTOM_PROMPT_STATUS_CACHE_TTL");
+    char const* workdir = C::git_repository_workdir(repo);
+    if (ttl_env == nullptr || workdir == nullptr || (this->ttl = std::atoll(ttl_env)) <= 0)
+    {
+        return;
+    }
+    this->workdir = workdir;
+    std::filesystem::path gitdir = C::git_repository_path(repo);
+    std::filesystem::path commondir = C::git_repository_commondir(repo);
+    std::error_code ec;
+    std::ostringstream fingerprint_stream;
+    fingerprint_stream << gitdir.string() << ' ' << (oid == nullptr ? "none" : C::git_oid_tostr_s(oid));
+    fingerprint_stream << ' ' << modification_time(gitdir / "index") << ' '
+                       << std::filesystem::file_size(gitdir / "index", ec);
+    fingerprint_stream << ' ' << modification_time(gitdir / "HEAD") << ' '
+                       << modification_time(commondir / "info/exclude");
+    // Counts obtained with different limits are not interchangeable.
+    StatusLimits status_limits;
+    fingerprint_stream << ' ' << status_limits.dirty << ' ' << status_limits.staged << ' ' << status_limits.untracked;
+    this->fingerprint = fingerprint_stream.str();
+    this->path = cache_file_path("status", gitdir.string());
+}
+
+/**
+ * Read the cached statuses if they are valid.
+ *
+ * @param dirty Number of modified files.
+ * @param staged Number of staged files.
+ * @param untracked Number of untracked files.
+ *
+ * @return Whether valid statuses were found. If not, the arguments are not
+ * modified.
+ */
+bool StatusCache::load(unsigned& dirty, unsigned& staged, unsigned& untracked) const
+{
+    if (this->path.empty())
+    {
+        return false;
+    }
+    std::ifstream cache_file(this->path);
+    std::string magic, fingerprint;
+    std::time_t created;
+    unsigned cached_dirty, cached_staged, cached_untracked;
+    if (!std::getline(cache_file, magic) || magic != STATUS_CACHE_MAGIC || !std::getline(cache_file, fingerprint)
+        || fingerprint != this->fingerprint
+        || !(cache_file >> created >> cached_dirty >> cached_staged >> cached_untracked))
+    {
+        return false;
+    }
+    std::time_t now = std::time(nullptr);
+    if (created > now || now - created >= this->ttl)
+    {
+        LOG_DEBUG(logger, "Cached statuses expired", "created", created, "now", now);
+        return false;
+    }
+
+    std::int64_t cached_mtime;
+    std::string directory;
+    while (cache_file >> cached_mtime && cache_file.get() == ' ' && std::getline(cache_file, directory))
+    {
+        if (modification_time(this->workdir / directory) != cached_mtime)
+        {
+            LOG_DEBUG(logger, "Cached statuses outdated", "directory", directory);
+            return false;
+        }
+    }
+    if (!cache_file.eof())
+    {
+        return false;
+    }
+    dirty = cached_dirty;
+    staged = cached_staged;
+    untracked = cached_untracked;
+    LOG_DEBUG(logger, "Using cached statuses", "path", this->path.string());
+    return true;
+}
+
+/**
+ * Cache the given statuses.
+ *
+ * @param dirty Number of modified files.
+ * @param staged Number of staged files.
+ * @param untracked Number of untracked files.
+ * @param untracked_directories Untracked directories, relative to the working
+ * tree. (Directories containing tracked files are found from the index.)
+ */
+void StatusCache::store(
+    unsigned dirty, unsigned staged, unsigned untracked, std::vector<std::string> const& untracked_directories
+) const
+{
+    if (this->path.empty())
+    {
+        return;
+    }
+    IndexFile index_file;
+    if (!index_file.load(this->repo))
+    {
+        return;
+    }
+
+    // Every ancestor of every tracked file must be watched, because creating
+    // an untracked file in any of them changes the statuses.
+    std::unordered_set<std::string_view> directories = { "" };
+    for (std::string_view const& entry_path : index_file.paths)
+    {
+        for (std::size_t pos = entry_path.rfind('/'); pos != std::string_view::npos && pos > 0;
+             pos = entry_path.rfind('/', pos - 1))
+        {
+            if (!directories.insert(entry_path.substr(0, pos)).second)
+            {
+                break;
+            }
+        }
+    }
+    for (std::string const& untracked_directory : untracked_directories)
+    {
+        directories.insert(untracked_directory);
+    }
+
+    std::ostringstream cache_stream;
+    cache_stream << STATUS_CACHE_MAGIC << '\n' << this->fingerprint << '\n';
+    cache_stream << std::time(nullptr) << ' ' << dirty << ' ' << staged << ' ' << untracked << '\n';
+    for (std::string_view const& directory : directories)
+    {
+        if (directory.find('\n') != std::string_view::npos)
+        {
+            // Cannot be remembered, so changes in it would go unnoticed. Make
+            // sure everything is examined next time.
+            return;
+        }
+        cache_stream << modification_time(this->workdir / directory) << ' ' << directory << '\n';
+    }
+    replace_file_contents(this->path, cache_stream.str());
+}
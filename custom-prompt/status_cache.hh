@@ -0,0 +1,31 @@
+#ifndef STATUS_CACHE_HH_
+#define STATUS_CACHE_HH_
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "libgit2.hh"
+
+/**
+ * Remember the statuses of the index and working tree of a Git repository
+ * across prompts, so that they need not be recomputed while nothing that
+ * could affect them has changed.
+ */
+class StatusCache
+{
+private:
+    C::git_repository* repo;
+    std::filesystem::path path, workdir;
+    std::string fingerprint;
+    std::time_t ttl;
+
+public:
+    StatusCache(C::git_repository*, C::git_oid const*);
+    bool load(unsigned&, unsigned&, unsigned&) const;
+    void store(unsigned, unsigned, unsigned, std::vector<std::string> const&) const;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <map>
+#include <string>
+#include <vector>
+
+#include "git_status.hh"
+#include "json_logger.hh"
+#include "status_ledger.hh"
+
+static JSONLogger logger;
+
+/**
+ * Prepare to record the statuses of the files in a Git repository. Nothing is
+ * recorded until the first full scan.
+ *
+ * @param repo Git repository.
+ */
+StatusLedger::StatusLedger(C::git_repository* repo) : repo(repo), dirty(0), staged(0), untracked(0)
+{
+}
+
+/**
+ * Scan the whole repository, discarding whatever was recorded earlier.
+ *
+ * @return Whether the scan succeeded.
+ */
+bool StatusLedger::rescan(void)
+{
+    this->statuses.clear();
+    this->dirty = this->staged = this->untracked = 0;
+    return this->scan(nullptr);
+}
+
+/**
+ * Scan only the given paths (and whatever lies inside them, if they are
+ * directories), keeping the recorded statuses of all other files.
+ *
+ * @param paths Paths relative to the working tree.
+ *
+ * @return Whether the scan succeeded.
+ */
+bool StatusLedger::rescan(std::vector<std::string> const& paths)
+{
+    std::vector<std::string> units;
+    for (std::string const& path : paths)
+    {
+        // A path inside an untracked directory doesn't have a status of its
+        // own; the directory does. Hence, examine the directory again.
+        std::string unit = path;
+        for (std::size_t pos = path.find('/'); pos != std::string::npos; pos = path.find('/', pos + 1))
+        {
+            if (this->statuses.count(path.substr(0, pos + 1)) > 0)
+            {
+                unit = path.substr(0, pos);
+                break;
+            }
+        }
+        this->forget(unit);
+        units.push_back(std::move(unit));
+    }
+    if (units.empty())
+    {
+        return true;
+    }
+    LOG_DEBUG(logger, "Scanning changed paths", "count", units.size());
+    std::vector<char*> strings;
+    for (std::string& unit : units)
+    {
+        strings.push_back(unit.data());
+    }
+    C::git_strarray pathspec = { strings.data(), strings.size() };
+    return this->scan(&pathspec);
+}
+
+/**
+ * Record the status of a file obtained earlier (e.g. in a previous process),
+ * as if it had been found while scanning.
+ *
+ * @param path File path.
+ * @param status_flags Flags indicating the status of the file.
+ */
+void StatusLedger::restore(char const* path, unsigned status_flags)
+{
+    this->update(path, status_flags, this);
+}
+
+/**
+ * Obtain the recorded statuses.
+ *
+ * @return Statuses of the files which are not clean, keyed on their paths.
+ */
+std::map<std::string, unsigned> const& StatusLedger::get_statuses(void) const
+{
+    return this->statuses;
+}
+
+/**
+ * Discard the recorded statuses of a path and whatever lies inside it.
+ *
+ * @param path Path relative to the working tree.
+ */
+void StatusLedger::forget(std::string const& path)
+{
+    // Paths inside the given one sort between these two, because the
+    // character following the slash in the latter is the one following the
+    // slash in the character set.
+    auto begin = this->statuses.lower_bound(path);
+    auto end = this->statuses.lower_bound(path + '0');
+    for (auto it = begin; it != end;)
+    {
+        if (it->first == path || it->first.compare(path.size(), 1, "/") == 0)
+        {
+            this->tally(it->second, -1);
+            it = this->statuses.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/**
+ * Add or remove the contribution of a file to the counts.
+ *
+ * @param status_flags Flags indicating the status of the file.
+ * @param sign 1 to add, -1 to remove.
+ */
+void StatusLedger::tally(unsigned status_flags, int sign)
+{
+    if (status_flags & DIRTY_STATUS_FLAGS)
+    {
+        this->dirty += sign;
+    }
+    if (status_flags & STAGED_STATUS_FLAGS)
+    {
+        this->staged += sign;
+    }
+    if (status_flags & UNTRACKED_STATUS_FLAGS)
+    {
+        this->untracked += sign;
+    }
+}
+
+/**
+ * Scan the repository and record the statuses of the files which are not
+ * clean.
+ *
+ * @param pathspec Paths to limit the scan to, or a null pointer to scan
+ * everything.
+ *
+ * @return Whether the scan succeeded.
+ */
+bool StatusLedger::scan(C::git_strarray const* pathspec)
+{
+    C::git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+    opts.flags = C::GIT_STATUS_OPT_INCLUDE_UNTRACKED | C::GIT_STATUS_OPT_EXCLUDE_SUBMODULES;
+    if (pathspec != nullptr)
+    {
+        // Besides disabling globbing, this makes libgit2 visit only the given
+        // paths instead of visiting everything and filtering.
+        opts.flags |= C::GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH;
+        opts.pathspec = *pathspec;
+    }
+    return C::git_status_foreach_ext(this->repo, &opts, this->update, this) == 0;
+}
+
+/**
+ * Record the status of the given file.
+ *
+ * @param path File path.
+ * @param status_flags Flags indicating the status of the file.
+ * @param self_ `StatusLedger` instance to record the status in.
+ *
+ * @return 0.
+ */
+int StatusLedger::update(char const* path, unsigned status_flags, void* self_)
+{
+    StatusLedger* self = static_cast<StatusLedger*>(self_);
+    auto [it, inserted] = self->statuses.emplace(path, status_flags);
+    if (!inserted)
+    {
+        self->tally(it->second, -1);
+        it->second = status_flags;
+    }
+    self->tally(status_flags, 1);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef STATUS_LEDGER_HH_
+#define STATUS_LEDGER_HH_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "libgit2.hh"
+
+/**
+ * Record the status of every file in a Git repository which is not clean, so
+ * that the statuses of a few files can be updated without a full scan.
+ */
+class StatusLedger
+{
+private:
+    C::git_repository* repo;
+    std::map<std::string, unsigned> statuses;
+
+public:
+    unsigned dirty, staged, untracked;
+
+public:
+    StatusLedger(C::git_repository*);
+    bool rescan(void);
+    bool rescan(std::vector<std::string> const&);
+    void restore(char const*, unsigned);
+    std::map<std::string, unsigned> const& get_statuses(void) const;
+
+private:
+    void forget(std::string const&);
+    void tally(unsigned, int);
+    bool scan(C::git_strarray const*);
+    static int update(char const*, unsigned, void*);
+};
+
+#endif
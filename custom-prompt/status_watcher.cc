@@ -0,0 +1,390 @@
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "json_logger.hh"
+#include "status_watcher.hh"
+
+static JSONLogger logger;
+
+#ifndef __linux__
+
+StatusWatcher::StatusWatcher(C::git_repository* repo) : ledger(repo)
+{
+}
+
+StatusWatcher::~StatusWatcher()
+{
+}
+
+bool StatusWatcher::peek_counts(unsigned& dirty, unsigned& staged, unsigned& untracked) const
+{
+    return false;
+}
+
+StatusWatcher* StatusWatcher::find(std::string const& workdir)
+{
+    return nullptr;
+}
+
+StatusWatcher* StatusWatcher::prepare(C::git_repository* repo)
+{
+    return nullptr;
+}
+
+std::vector<int> StatusWatcher::get_all_fds(void)
+{
+    return {};
+}
+
+void StatusWatcher::dispatch_events(int fd)
+{
+}
+
+#else
+
+#include <cerrno>
+#include <filesystem>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Events in the working tree which may change the status of a file.
+static std::uint32_t constexpr WORKDIR_EVENTS
+    = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+// Events in the Git directory which may change the status of any file. Git
+// writes files there by renaming lock files.
+static std::uint32_t constexpr GITDIR_EVENTS = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_ONLYDIR;
+
+/**
+ * Watchers of Git repositories, keyed on their working trees.
+ */
+static std::map<std::string, std::unique_ptr<StatusWatcher>> status_watchers;
+
+/**
+ * Open a Git repository for a watcher to own, so that it remains valid however
+ * long the watcher lives, independently of the repositories the server keeps
+ * open.
+ *
+ * @param workdir Working tree of the repository.
+ *
+ * @return Git repository, or a null pointer if it could not be opened.
+ */
+static C::git_repository* open_watched_repository(char const* workdir)
+{
+    C::git_repository* repo;
+    if (C::git_repository_open(&repo, workdir) != 0)
+    {
+        return nullptr;
+    }
+    return repo;
+}
+
+/**
+ * Start watching a Git repository. The statuses of its files are not obtained
+ * until they are requested.
+ *
+ * @param repo Git repository with a working tree. The watcher opens it again
+ * for itself.
+ */
+StatusWatcher::StatusWatcher(C::git_repository* repo) :
+    repo(open_watched_repository(C::git_repository_workdir(repo))), workdir(C::git_repository_workdir(repo)),
+    gitdir(C::git_repository_path(repo)), inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), gitdir_wd(-1),
+    stale(true), ledger(this->repo)
+{
+    if (this->inotify_fd < 0)
+    {
+        return;
+    }
+    if (this->repo == nullptr)
+    {
+        close(this->inotify_fd);
+        this->inotify_fd = -1;
+        return;
+    }
+    this->gitdir_wd = inotify_add_watch(this->inotify_fd, this->gitdir.data(), GITDIR_EVENTS);
+    if (this->gitdir_wd < 0 || !this->watch_directory(""))
+    {
+        close(this->inotify_fd);
+        this->inotify_fd = -1;
+    }
+}
+
+/**
+ * Stop watching, and close the repository.
+ */
+StatusWatcher::~StatusWatcher()
+{
+    if (this->inotify_fd >= 0)
+    {
+        close(this->inotify_fd);
+    }
+    C::git_repository_free(this->repo);
+}
+
+/**
+ * Obtain the file descriptor which becomes readable when there are changes.
+ *
+ * @return File descriptor, or -1 if watching is not possible.
+ */
+int StatusWatcher::get_fd(void) const
+{
+    return this->inotify_fd;
+}
+
+/**
+ * Watch a directory and all directories inside it which are not ignored.
+ *
+ * @param directory Directory relative to the working tree.
+ *
+ * @return Whether the directory is watched. This is false only if the system
+ * limit on the number of watches has been reached.
+ */
+bool StatusWatcher::watch_directory(std::string const& directory)
+{
+    int ignored = 0;
+    if (!directory.empty() && C::git_ignore_path_is_ignored(&ignored, this->repo, (directory + '/').data()) == 0
+        && ignored)
+    {
+        return true;
+    }
+    std::string path = this->workdir + directory;
+    int wd = inotify_add_watch(this->inotify_fd, path.data(), WORKDIR_EVENTS);
+    if (wd < 0)
+    {
+        // The directory may have been deleted already. Not a problem.
+        return errno != ENOSPC && errno != ENOMEM;
+    }
+    this->watched_directories[wd] = directory;
+
+    std::error_code ec;
+    for (auto const& entry : std::filesystem::directory_iterator(path, ec))
+    {
+        std::string name = entry.path().filename().string();
+        if (!entry.is_directory(ec) || entry.is_symlink(ec) || name == ".git")
+        {
+            continue;
+        }
+        if (!this->watch_directory(directory.empty() ? name : directory + '/' + name))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Consume all pending change notifications, and remember which paths changed.
+ */
+void StatusWatcher::process_events(void)
+{
+    alignas(inotify_event) char buf[16384];
+    ssize_t count;
+    while ((count = read(this->inotify_fd, buf, sizeof buf / sizeof *buf)) > 0)
+    {
+        for (char* ptr = buf; ptr < buf + count;)
+        {
+            inotify_event const* event = reinterpret_cast<inotify_event const*>(ptr);
+            ptr += sizeof *event + event->len;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                this->stale = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                this->watched_directories.erase(event->wd);
+                continue;
+            }
+            if (event->len == 0)
+            {
+                continue;
+            }
+            std::string name = event->name;
+            if (event->wd == this->gitdir_wd)
+            {
+                // Any change to HEAD or the index may affect every file.
+                // Don't try to be clever.
+                if (name == "HEAD" || name == "index")
+                {
+                    this->stale = true;
+                }
+                continue;
+            }
+            auto it = this->watched_directories.find(event->wd);
+            if (it == this->watched_directories.end())
+            {
+                continue;
+            }
+            if (name == ".gitignore")
+            {
+                this->stale = true;
+                continue;
+            }
+            std::string path = it->second.empty() ? name : it->second + '/' + name;
+            if (path == ".git")
+            {
+                continue;
+            }
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && !this->watch_directory(path))
+            {
+                this->stale = true;
+            }
+            this->changed_paths.insert(std::move(path));
+        }
+    }
+}
+
+/**
+ * Bring the statuses up to date.
+ *
+ * @param dirty Number of modified files.
+ * @param staged Number of staged files.
+ * @param untracked Number of untracked files.
+ *
+ * @return Whether the statuses are available.
+ */
+bool StatusWatcher::get_counts(unsigned& dirty, unsigned& staged, unsigned& untracked)
+{
+    if (this->inotify_fd < 0)
+    {
+        return false;
+    }
+    this->process_events();
+    if (this->stale)
+    {
+        LOG_DEBUG(logger, "Scanning watched repository", "workdir", this->workdir);
+        this->changed_paths.clear();
+        this->stale = !this->ledger.rescan();
+    }
+    else if (!this->changed_paths.empty())
+    {
+        std::vector<std::string> paths(this->changed_paths.begin(), this->changed_paths.end());
+        this->changed_paths.clear();
+        this->stale = !this->ledger.rescan(paths);
+    }
+    return this->peek_counts(dirty, staged, untracked);
+}
+
+/**
+ * Obtain the statuses without bringing them up to date. This is meant to be
+ * used by processes forked from the one watching, right after the latter
+ * brought them up to date.
+ *
+ * @param dirty Number of modified files.
+ * @param staged Number of staged files.
+ * @param untracked Number of untracked files.
+ *
+ * @return Whether the statuses are available.
+ */
+bool StatusWatcher::peek_counts(unsigned& dirty, unsigned& staged, unsigned& untracked) const
+{
+    if (this->inotify_fd < 0 || this->stale || !this->changed_paths.empty())
+    {
+        return false;
+    }
+    dirty = this->ledger.dirty;
+    staged = this->ledger.staged;
+    untracked = this->ledger.untracked;
+    return true;
+}
+
+/**
+ * Find the watcher of a Git repository.
+ *
+ * @param workdir Working tree of the repository.
+ *
+ * @return Watcher, or a null pointer if the repository is not watched.
+ */
+StatusWatcher* StatusWatcher::find(std::string const& workdir)
+{
+    auto it = status_watchers.find(workdir);
+    if (it == status_watchers.end())
+    {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+/**
+ * Start watching a Git repository (unless it is already being watched), and
+ * bring its statuses up to date. Watching is enabled only if the environment
+ * variable `CUSTOM_PROMPT_WATCH` is set to a non-zero number.
+ *
+ * @param repo Git repository.
+ *
+ * @return Watcher, or a null pointer if the repository can't be watched.
+ */
+StatusWatcher* StatusWatcher::prepare(C::git_repository* repo)
+{
+    char const* watch_env = std::getenv("CUSTOM_PROMPT_WATCH");
+    char const* workdir = C::git_repository_workdir(repo);
+    if (watch_env == nullptr || std::atoi(watch_env) == 0 || workdir == nullptr)
+    {
+        return nullptr;
+    }
+    StatusWatcher* status_watcher = StatusWatcher::find(workdir);
+    if (status_watcher == nullptr)
+    {
+        // Every watched directory counts against a system-wide limit. Don't
+        // hog it.
+        if (status_watchers.size() >= 16)
+        {
+            status_watchers.clear();
+        }
+        status_watcher = new StatusWatcher(repo);
+        status_watchers.emplace(workdir, status_watcher);
+        LOG_DEBUG(
+            logger, "Started watching repository", "workdir", workdir,
+            "directories", status_watcher->watched_directories.size()
+        );
+    }
+    unsigned dirty, staged, untracked;
+    status_watcher->get_counts(dirty, staged, untracked);
+    return status_watcher;
+}
+
+/**
+ * Obtain the file descriptors which become readable when there are changes in
+ * any watched repository.
+ *
+ * @return File descriptors.
+ */
+std::vector<int> StatusWatcher::get_all_fds(void)
+{
+    std::vector<int> fds;
+    for (auto const& status_watcher : status_watchers)
+    {
+        if (status_watcher.second->get_fd() >= 0)
+        {
+            fds.push_back(status_watcher.second->get_fd());
+        }
+    }
+    return fds;
+}
+
+/**
+ * Bring the statuses of the watched repository whose file descriptor is
+ * readable up to date.
+ *
+ * @param fd File descriptor.
+ */
+void StatusWatcher::dispatch_events(int fd)
+{
+    for (auto const& status_watcher : status_watchers)
+    {
+        if (status_watcher.second->get_fd() == fd)
+        {
+            unsigned dirty, staged, untracked;
+            status_watcher.second->get_counts(dirty, staged, untracked);
+            return;
+        }
+    }
+}
+
+#endif
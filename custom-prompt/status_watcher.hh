@@ -0,0 +1,46 @@
+#ifndef STATUS_WATCHER_HH_
+#define STATUS_WATCHER_HH_
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "libgit2.hh"
+#include "status_ledger.hh"
+
+/**
+ * Keep the statuses of the files in a Git repository up to date by watching
+ * the working tree and the Git directory for changes, so that only the paths
+ * which changed need to be examined again.
+ */
+class StatusWatcher
+{
+private:
+    C::git_repository* repo;
+    std::string workdir, gitdir;
+    int inotify_fd;
+    std::unordered_map<int, std::string> watched_directories;
+    int gitdir_wd;
+    bool stale;
+    std::unordered_set<std::string> changed_paths;
+    StatusLedger ledger;
+
+public:
+    StatusWatcher(C::git_repository*);
+    ~StatusWatcher();
+    int get_fd(void) const;
+    void process_events(void);
+    bool get_counts(unsigned&, unsigned&, unsigned&);
+    bool peek_counts(unsigned&, unsigned&, unsigned&) const;
+
+    static StatusWatcher* find(std::string const&);
+    static StatusWatcher* prepare(C::git_repository*);
+    static std::vector<int> get_all_fds(void);
+    static void dispatch_events(int);
+
+private:
+    bool watch_directory(std::string const&);
+};
+
+#endif
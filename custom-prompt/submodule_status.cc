@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "json_logger.hh"
+#include "submodule_status.hh"
+#include "thread_pool.hh"
+#include "trace_span.hh"
+
+static JSONLogger logger;
+
+// Verdicts about submodules.
+static int constexpr SUBMODULE_PENDING = -1;
+static int constexpr SUBMODULE_CLEAN = 0;
+static int constexpr SUBMODULE_DIRTY = 1;
+static int constexpr SUBMODULE_FAILED = 2;
+
+// Statuses which make a submodule count as modified: a different commit is
+// checked out, or its working tree has changes.
+static unsigned constexpr SUBMODULE_DIRTY_STATUS_FLAGS = C::GIT_SUBMODULE_STATUS_WD_MODIFIED
+    | C::GIT_SUBMODULE_STATUS_WD_INDEX_MODIFIED | C::GIT_SUBMODULE_STATUS_WD_WD_MODIFIED
+    | C::GIT_SUBMODULE_STATUS_WD_UNTRACKED;
+
+/**
+ * Determine the number of threads on which submodules are scanned. Scanning is
+ * mostly waiting for the file system, so use more threads than there are cores
+ * on small machines.
+ *
+ * @return Number of threads.
+ */
+static std::size_t submodule_thread_count(void)
+{
+    return std::max(4U, std::thread::hardware_concurrency());
+}
+
+/**
+ * Obtain the thread pool on which submodules are scanned. It is never
+ * destroyed, because scans which overrun their budgets are not waited for,
+ * and must not hold up the exit of this process.
+ *
+ * @return Thread pool.
+ */
+static ThreadPool& submodule_thread_pool(void)
+{
+    static ThreadPool* thread_pool = new ThreadPool(submodule_thread_count());
+    return *thread_pool;
+}
+
+/**
+ * Collect the name of a submodule.
+ *
+ * @param submodule Submodule.
+ * @param name Name of the submodule.
+ * @param names_ Names collected so far.
+ *
+ * @return 0, to continue iterating.
+ */
+static int collect_submodule_name(C::git_submodule* submodule, char const* name, void* names_)
+{
+    static_cast<std::vector<std::string>*>(names_)->emplace_back(name);
+    return 0;
+}
+
+/**
+ * Read the time budget for each submodule.
+ */
+SubmoduleStatus::SubmoduleStatus(void) : budget(0)
+{
+    char const* budget_env = std::getenv("CUSTOM_PROMPT_SUBMODULE_BUDGET");
+    if (budget_env != nullptr)
+    {
+        this->budget = std::chrono::milliseconds(std::max(0LL, std::atoll(budget_env)));
+    }
+}
+
+/**
+ * Start scanning the submodules of a Git repository, if enabled.
+ *
+ * @param repo Git repository.
+ */
+void SubmoduleStatus::start(C::git_repository* repo)
+{
+    TraceSpan trace_span(__func__);
+    char const* workdir = C::git_repository_workdir(repo);
+    if (this->budget.count() <= 0 || workdir == nullptr)
+    {
+        return;
+    }
+    std::vector<std::string> names;
+    if (C::git_submodule_foreach(repo, collect_submodule_name, &names) != 0 || names.empty())
+    {
+        return;
+    }
+    LOG_DEBUG(logger, "Scanning submodules", "count", names.size());
+    // Submodules still waiting for a thread are waited for at most as long as
+    // it would take to scan all of them one batch at a time.
+    std::size_t threads = submodule_thread_count();
+    this->deadline = std::chrono::steady_clock::now() + this->budget * ((names.size() + threads - 1) / threads);
+    this->state = std::make_shared<SubmoduleScanState>();
+    this->state->workdir = workdir;
+    this->state->names = std::move(names);
+    this->state->started_at.resize(this->state->names.size(), std::chrono::steady_clock::time_point::max());
+    this->state->verdicts.resize(this->state->names.size(), SUBMODULE_PENDING);
+    ThreadPool& thread_pool = submodule_thread_pool();
+    for (std::size_t i = 0; i < this->state->names.size(); ++i)
+    {
+        thread_pool.submit(
+            [state = this->state, i]
+            {
+                SubmoduleStatus::scan(state, i);
+            }
+        );
+    }
+}
+
+/**
+ * Wait for the submodules to be scanned. Each submodule is waited for until its
+ * budget (counted from when its scan started) runs out, and none is waited for
+ * after the deadline of the whole scan.
+ *
+ * @param dirty Number of modified submodules.
+ * @param unknown Number of submodules whose status is not known.
+ */
+void SubmoduleStatus::finish(unsigned& dirty, unsigned& unknown)
+{
+    TraceSpan trace_span(__func__);
+    if (this->state == nullptr)
+    {
+        return;
+    }
+    std::size_t count = this->state->names.size();
+    std::unique_lock<std::mutex> lock(this->state->mutex);
+    while (true)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto wake = this->deadline;
+        bool waiting = false;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (this->state->verdicts[i] != SUBMODULE_PENDING)
+            {
+                continue;
+            }
+            auto expiry = this->state->started_at[i] == std::chrono::steady_clock::time_point::max()
+                ? this->deadline
+                : this->state->started_at[i] + this->budget;
+            if (expiry > now)
+            {
+                waiting = true;
+                wake = std::min(wake, expiry);
+            }
+        }
+        if (!waiting || now >= this->deadline)
+        {
+            break;
+        }
+        this->state->cv.wait_until(lock, wake);
+    }
+    dirty = unknown = 0;
+    for (int verdict : this->state->verdicts)
+    {
+        dirty += verdict == SUBMODULE_DIRTY;
+        unknown += verdict == SUBMODULE_PENDING || verdict == SUBMODULE_FAILED;
+    }
+    LOG_DEBUG(logger, "Scanned submodules", "dirty", dirty, "unknown", unknown);
+    this->state = nullptr;
+}
+
+/**
+ * Scan a submodule. Called on a thread of the pool. The repository is opened
+ * again, because libgit2 objects must not be shared between threads.
+ *
+ * @param state Progress of the scan.
+ * @param i Index of the submodule.
+ */
+void SubmoduleStatus::scan(std::shared_ptr<SubmoduleScanState> state, std::size_t i)
+{
+    TraceSpan trace_span(__func__);
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->started_at[i] = std::chrono::steady_clock::now();
+    }
+    int verdict = SUBMODULE_FAILED;
+    C::git_repository* repo;
+    if (C::git_repository_open(&repo, state->workdir.data()) == 0)
+    {
+        unsigned status;
+        if (C::git_submodule_status(&status, repo, state->names[i].data(), C::GIT_SUBMODULE_IGNORE_UNSPECIFIED) == 0)
+        {
+            verdict = status & SUBMODULE_DIRTY_STATUS_FLAGS ? SUBMODULE_DIRTY : SUBMODULE_CLEAN;
+        }
+        C::git_repository_free(repo);
+    }
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->verdicts[i] = verdict;
+    }
+    state->cv.notify_all();
+}
@@ -0,0 +1,51 @@
+#ifndef SUBMODULE_STATUS_HH_
+#define SUBMODULE_STATUS_HH_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "libgit2.hh"
+
+/**
+ * Progress of scanning the submodules of a Git repository. Shared with the
+ * threads scanning them, which may outlive the scan if they overrun.
+ */
+struct SubmoduleScanState
+{
+    std::string workdir;
+    std::vector<std::string> names;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::chrono::steady_clock::time_point> started_at;
+    std::vector<int> verdicts;
+};
+
+/**
+ * Check which submodules of a Git repository are modified, concurrently and
+ * with a time budget for each submodule. Submodules whose status could not be
+ * obtained within the budget are reported as unknown. This is enabled only if
+ * the environment variable `CUSTOM_PROMPT_SUBMODULE_BUDGET` is set to a
+ * positive number of milliseconds.
+ */
+class SubmoduleStatus
+{
+private:
+    std::chrono::milliseconds budget;
+    std::chrono::steady_clock::time_point deadline;
+    std::shared_ptr<SubmoduleScanState> state;
+
+public:
+    SubmoduleStatus(void);
+    void start(C::git_repository*);
+    void finish(unsigned&, unsigned&);
+
+private:
+    static void scan(std::shared_ptr<SubmoduleScanState>, std::size_t);
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include "disk_cache.hh"
+#include "json_logger.hh"
+#include "tag_index.hh"
+
+static JSONLogger logger;
+
+static char const TAG_INDEX_MAGIC[] = "custom-prompt-tags 1";
+
+/**
+ * Tag indices of Git repositories, keyed on their common directories. In the
+ * server, these are inherited by every process serving a request. Shared, so
+ * that one being replaced in one thread remains valid in others still using
+ * it.
+ */
+static std::map<std::string, std::shared_ptr<TagIndex const>> tag_indices;
+static std::mutex tag_indices_mutex;
+
+/**
+ * Describe the state of the references files holding the tags of a Git
+ * repository. Any tag being created, deleted or moved changes either the
+ * packed references file or the modification time of a directory of loose
+ * tags (because Git writes references by renaming lock files).
+ *
+ * @param commondir Common directory of the repository.
+ *
+ * @return Fingerprint.
+ */
+static std::string tag_fingerprint(std::filesystem::path const& commondir)
+{
+    std::error_code ec;
+    std::ostringstream fingerprint_stream;
+    fingerprint_stream << commondir.string() << ' ' << modification_time(commondir / "packed-refs") << ' '
+                       << std::filesystem::file_size(commondir / "packed-refs", ec);
+    std::filesystem::path tags_directory = commondir / "refs/tags";
+    fingerprint_stream << ' ' << modification_time(tags_directory);
+    for (auto const& entry : std::filesystem::recursive_directory_iterator(tags_directory, ec))
+    {
+        if (entry.is_directory(ec))
+        {
+            fingerprint_stream << ' ' << modification_time(entry.path());
+        }
+    }
+    return fingerprint_stream.str();
+}
+
+/**
+ * Find the commit an object ID ultimately refers to, by peeling annotated
+ * tags (which may point to other annotated tags).
+ *
+ * @param repo Git repository.
+ * @param hex Object ID in hexadecimal.
+ *
+ * @return Object ID of the commit in hexadecimal, or an empty string if the
+ * object ID is invalid.
+ */
+static std::string peel_tag(C::git_repository* repo, std::string const& hex)
+{
+    C::git_oid oid;
+    if (C::git_oid_fromstr(&oid, hex.data()) != 0)
+    {
+        return "";
+    }
+    C::git_tag* tag;
+    while (C::git_tag_lookup(&tag, repo, &oid) == 0)
+    {
+        oid = *C::git_tag_target_id(tag);
+        C::git_tag_free(tag);
+    }
+    return C::git_oid_tostr_s(&oid);
+}
+
+/**
+ * Prepare an empty tag index.
+ *
+ * @param fingerprint State of the references files the index is built from.
+ */
+TagIndex::TagIndex(std::string const& fingerprint) : fingerprint(fingerprint)
+{
+}
+
+/**
+ * Find the tag pointing to a commit. If there are several, the one whose name
+ * comes first is found.
+ *
+ * @param oid Object ID of the commit.
+ *
+ * @return Tag name, or an empty string if there is no such tag.
+ */
+std::string TagIndex::find(C::git_oid const* oid) const
+{
+    auto it = this->tags.find(C::git_oid_tostr_s(oid));
+    if (it == this->tags.end())
+    {
+        return "";
+    }
+    return it->second;
+}
+
+/**
+ * Read the cached tag index if it is valid.
+ *
+ * @param path Cache file path.
+ *
+ * @return Whether a valid tag index was found.
+ */
+bool TagIndex::load(std::filesystem::path const& path)
+{
+    std::ifstream cache_file(path);
+    std::string magic, fingerprint;
+    if (!std::getline(cache_file, magic) || magic != TAG_INDEX_MAGIC || !std::getline(cache_file, fingerprint)
+        || fingerprint != this->fingerprint)
+    {
+        return false;
+    }
+    std::string oid, name;
+    while (cache_file >> oid && cache_file.get() == ' ' && std::getline(cache_file, name))
+    {
+        this->tags.emplace(std::move(oid), std::move(name));
+    }
+    if (!cache_file.eof())
+    {
+        this->tags.clear();
+        return false;
+    }
+    LOG_DEBUG(logger, "Using cached tag index", "path", path.string(), "tags", this->tags.size());
+    return true;
+}
+
+/**
+ * Build the tag index from the packed references file (whose peeled lines
+ * save looking up annotated tags) and the loose tags (which take precedence).
+ *
+ * @param repo Git repository.
+ * @param commondir Common directory of the repository.
+ */
+void TagIndex::build(C::git_repository* repo, std::filesystem::path const& commondir)
+{
+    // Object IDs of the commits the tags point to, keyed on the tag names. An
+    // empty object ID means that the tag could not be peeled.
+    std::map<std::string, std::string> peeled_tags;
+    std::ifstream packed_refs_file(commondir / "packed-refs");
+    bool packed_refs_peeled = false;
+    std::string line, last_name;
+    while (std::getline(packed_refs_file, line))
+    {
+        if (line.rfind("# pack-refs with:", 0) == 0)
+        {
+            std::string traits = line.substr(17) + ' ';
+            packed_refs_peeled = traits.find(" peeled ") != std::string::npos
+                || traits.find(" fully-peeled ") != std::string::npos;
+            continue;
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        if (line[0] == '^')
+        {
+            if (!last_name.empty())
+            {
+                peeled_tags[last_name] = line.substr(1);
+            }
+            continue;
+        }
+        std::size_t pos = line.find(' ');
+        last_name.clear();
+        if (pos == std::string::npos || line.compare(pos + 1, 10, "refs/tags/") != 0)
+        {
+            continue;
+        }
+        last_name = line.substr(pos + 11);
+        // If the file is peeled, tags without peeled lines are unannotated.
+        std::string hex = line.substr(0, pos);
+        peeled_tags[last_name] = packed_refs_peeled ? hex : peel_tag(repo, hex);
+    }
+
+    std::error_code ec;
+    std::filesystem::path tags_directory = commondir / "refs/tags";
+    for (auto const& entry : std::filesystem::recursive_directory_iterator(tags_directory, ec))
+    {
+        if (!entry.is_regular_file(ec))
+        {
+            continue;
+        }
+        std::ifstream tag_file(entry.path());
+        std::string hex;
+        if (!(tag_file >> hex))
+        {
+            continue;
+        }
+        std::string name = entry.path().lexically_relative(tags_directory).generic_string();
+        peeled_tags[name] = peel_tag(repo, hex);
+    }
+
+    for (auto& peeled_tag : peeled_tags)
+    {
+        if (!peeled_tag.second.empty())
+        {
+            this->tags.emplace(std::move(peeled_tag.second), peeled_tag.first);
+        }
+    }
+    LOG_DEBUG(logger, "Built tag index", "commondir", commondir.string(), "tags", this->tags.size());
+}
+
+/**
+ * Cache the tag index.
+ *
+ * @param path Cache file path.
+ */
+void TagIndex::store(std::filesystem::path const& path) const
+{
+    std::ostringstream cache_stream;
+    cache_stream << TAG_INDEX_MAGIC << '\n' << this->fingerprint << '\n';
+    for (auto const& tag : this->tags)
+    {
+        if (tag.second.find('\n') == std::string::npos)
+        {
+            cache_stream << tag.first << ' ' << tag.second << '\n';
+        }
+    }
+    replace_file_contents(path, cache_stream.str());
+}
+
+/**
+ * Obtain the tag index of a Git repository. Use the one in memory or the one
+ * on disk if it is still valid. Otherwise, build it.
+ *
+ * @param repo Git repository.
+ *
+ * @return Tag index.
+ */
+std::shared_ptr<TagIndex const> TagIndex::get(C::git_repository* repo)
+{
+    std::filesystem::path commondir = C::git_repository_commondir(repo);
+    std::string fingerprint = tag_fingerprint(commondir);
+    {
+        std::lock_guard<std::mutex> lock(tag_indices_mutex);
+        auto it = tag_indices.find(commondir.string());
+        if (it != tag_indices.end() && it->second->fingerprint == fingerprint)
+        {
+            return it->second;
+        }
+    }
+
+    // Don't keep other threads waiting while building.
+    std::shared_ptr<TagIndex> tag_index(new TagIndex(fingerprint));
+    std::filesystem::path path = cache_file_path("tags", commondir.string());
+    if (path.empty() || !tag_index->load(path))
+    {
+        tag_index->build(repo, commondir);
+        if (!path.empty())
+        {
+            tag_index->store(path);
+        }
+    }
+    std::lock_guard<std::mutex> lock(tag_indices_mutex);
+    // Don't let the number of tag indices grow without bound.
+    if (tag_indices.size() >= 16 && tag_indices.count(commondir.string()) == 0)
+    {
+        tag_indices.clear();
+    }
+    tag_indices[commondir.string()] = tag_index;
+    return tag_index;
+}
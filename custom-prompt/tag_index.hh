@@ -0,0 +1,33 @@
+#ifndef TAG_INDEX_HH_
+#define TAG_INDEX_HH_
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "libgit2.hh"
+
+/**
+ * Names of the tags of a Git repository, keyed on the object IDs of the
+ * commits they point to (after peeling annotated tags). Built from the
+ * references files directly, and cached on disk until those change.
+ */
+class TagIndex
+{
+private:
+    std::string fingerprint;
+    std::unordered_map<std::string, std::string> tags;
+
+public:
+    std::string find(C::git_oid const*) const;
+    static std::shared_ptr<TagIndex const> get(C::git_repository*);
+
+private:
+    TagIndex(std::string const&);
+    bool load(std::filesystem::path const&);
+    void build(C::git_repository*, std::filesystem::path const&);
+    void store(std::filesystem::path const&) const;
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "thread_pool.hh"
+
+/**
+ * Start the threads.
+ *
+ * @param size Number of threads.
+ */
+ThreadPool::ThreadPool(std::size_t size) : stopping(false)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        this->workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+/**
+ * Finish all submitted tasks, and stop the threads.
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->tasks_mutex);
+        this->stopping = true;
+    }
+    this->tasks_cv.notify_all();
+    for (std::thread& worker : this->workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * Submit a task.
+ *
+ * @param function Task.
+ *
+ * @return Future which becomes ready when the task is finished.
+ */
+std::future<void> ThreadPool::submit(std::function<void(void)> function)
+{
+    std::packaged_task<void(void)> task(std::move(function));
+    std::future<void> future = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(this->tasks_mutex);
+        this->tasks.push(std::move(task));
+    }
+    this->tasks_cv.notify_one();
+    return future;
+}
+
+/**
+ * Determine the number of threads to use from an environment variable. If it
+ * is 0, use as many threads as there are cores; if it isn't set, use 1.
+ *
+ * @param name Name of the environment variable.
+ *
+ * @return Number of threads.
+ */
+std::size_t ThreadPool::default_size(char const* name)
+{
+    char const* size_env = std::getenv(name);
+    if (size_env == nullptr)
+    {
+        return 1;
+    }
+    long long size = std::atoll(size_env);
+    if (size <= 0)
+    {
+        return std::max(1U, std::thread::hardware_concurrency());
+    }
+    return size;
+}
+
+/**
+ * Run tasks until asked to stop.
+ */
+void ThreadPool::work(void)
+{
+    while (true)
+    {
+        std::packaged_task<void(void)> task;
+        {
+            std::unique_lock<std::mutex> lock(this->tasks_mutex);
+            this->tasks_cv.wait(
+                lock,
+                [this]
+                {
+                    return this->stopping || !this->tasks.empty();
+                }
+            );
+            if (this->tasks.empty())
+            {
+                return;
+            }
+            task = std::move(this->tasks.front());
+            this->tasks.pop();
+        }
+        task();
+    }
+}
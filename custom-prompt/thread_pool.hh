@@ -0,0 +1,35 @@
+#ifndef THREAD_POOL_HH_
+#define THREAD_POOL_HH_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * Run tasks on a fixed number of threads.
+ */
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void(void)>> tasks;
+    std::mutex tasks_mutex;
+    std::condition_variable tasks_cv;
+    bool stopping;
+
+public:
+    ThreadPool(std::size_t);
+    ~ThreadPool();
+    std::future<void> submit(std::function<void(void)>);
+    static std::size_t default_size(char const*);
+
+private:
+    void work(void);
+};
+
+#endif
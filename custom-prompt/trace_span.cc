@@ -0,0 +1,102 @@
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "json_logger.hh"
+#include "trace_span.hh"
+
+#define LEFT_CURLY_BRACKET "\x7B"
+#define RIGHT_CURLY_BRACKET "\x7D"
+
+/**
+ * Obtain the path of the file trace events are appended to.
+ *
+ * @return Path, or a null pointer if tracing is disabled.
+ */
+static char const* trace_file_path(void)
+{
+    static char const* path = []
+    {
+        char const* path_env = std::getenv("CUSTOM_PROMPT_TRACE");
+        return path_env == nullptr || *path_env == '\0' ? nullptr : path_env;
+    }();
+    return path;
+}
+
+/**
+ * Start measuring.
+ *
+ * @param name Name of the span. Must outlive the span; typically `__func__`.
+ */
+TraceSpan::TraceSpan(char const* name) : name(name)
+{
+    if (TraceSpan::is_enabled())
+    {
+        this->begin = std::chrono::steady_clock::now();
+    }
+}
+
+/**
+ * Stop measuring and append a complete event to the trace file. The file is in
+ * the JSON array format, whose closing bracket is optional, so that events of
+ * different processes can be appended independently. Each event is written at
+ * once to avoid interleaving.
+ */
+TraceSpan::~TraceSpan()
+{
+    if (!TraceSpan::is_enabled())
+    {
+        return;
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto ts = std::chrono::duration_cast<std::chrono::microseconds>(this->begin.time_since_epoch()).count();
+    auto dur = std::chrono::duration_cast<std::chrono::microseconds>(end - this->begin).count();
+#ifdef _WIN32
+    long pid = 0;
+#else
+    long pid = getpid();
+#endif
+    unsigned long tid = std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xFFFFFFFFUL;
+
+    // The buffer reserves enough space to terminate the event.
+    JSONBuffer event_buffer;
+    std::error_code ec;
+    if (std::filesystem::file_size(trace_file_path(), ec) == 0 || ec)
+    {
+        event_buffer.append("[\n");
+    }
+    event_buffer.append(LEFT_CURLY_BRACKET "\"name\":");
+    event_buffer.append_value(this->name);
+    event_buffer.append(",\"cat\":\"prompt\",\"ph\":\"X\",\"ts\":");
+    event_buffer.append_value(ts);
+    event_buffer.append(",\"dur\":");
+    event_buffer.append_value(dur);
+    event_buffer.append(",\"pid\":");
+    event_buffer.append_value(pid);
+    event_buffer.append(",\"tid\":");
+    event_buffer.append_value(tid);
+    event_buffer.close(RIGHT_CURLY_BRACKET ",\n");
+    std::string_view event = event_buffer.view();
+    std::ofstream trace_file(trace_file_path(), std::ios::app | std::ios::binary);
+    trace_file.write(event.data(), event.size()).flush();
+}
+
+/**
+ * Check whether tracing is enabled. It is if the environment variable
+ * `CUSTOM_PROMPT_TRACE` is the path of the file to write trace events to.
+ *
+ * @return Whether tracing is enabled.
+ */
+bool TraceSpan::is_enabled(void)
+{
+    return trace_file_path() != nullptr;
+}
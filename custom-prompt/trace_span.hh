@@ -0,0 +1,23 @@
+#ifndef TRACE_SPAN_HH_
+#define TRACE_SPAN_HH_
+
+#include <chrono>
+
+/**
+ * Record the running time of the enclosing scope as a Chrome trace event, if
+ * tracing is enabled. Unlike debug logging, this is available in release
+ * builds.
+ */
+class TraceSpan
+{
+private:
+    char const* name;
+    std::chrono::steady_clock::time_point begin;
+
+public:
+    TraceSpan(char const*);
+    ~TraceSpan();
+    static bool is_enabled(void);
+};
+
+#endif
@@ -0,0 +1,451 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "disk_cache.hh"
+#include "git_status.hh"
+#include "index_file.hh"
+#include "json_logger.hh"
+#include "trace_span.hh"
+#include "untracked_cache.hh"
+
+static JSONLogger logger;
+
+static char const UNTRACKED_CACHE_MAGIC[] = "custom-prompt-untracked 1";
+
+// Kinds of directory entries remembered. Tracked files are not remembered:
+// the digest of the names of tracked entries tells whether they changed.
+static char constexpr UNTRACKED_FILE = 'f';
+static char constexpr SUBDIRECTORY = 'd';
+static char constexpr NESTED_REPOSITORY = 'g';
+
+/**
+ * Obtain the path of an entry of a directory of the working tree.
+ *
+ * @param directory Directory, relative to the working tree.
+ * @param name Entry name.
+ *
+ * @return Entry path, relative to the working tree.
+ */
+static std::string child_path(std::string_view directory, std::string_view name)
+{
+    std::string path(directory);
+    if (!path.empty())
+    {
+        path += '/';
+    }
+    return path += name;
+}
+
+/**
+ * Hash the name of a tracked entry. The hashes of the names in a directory are
+ * added up, so that the digest does not depend on the order of the names.
+ *
+ * @param name Entry name.
+ *
+ * @return Hash.
+ */
+static std::uint64_t hash_name(std::string_view name)
+{
+    // FNV-1a.
+    std::uint64_t hash = 0xCBF29CE484222325U;
+    for (char c : name)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3U;
+    }
+    return hash;
+}
+
+/**
+ * Prepare to count the untracked files in the given Git repository. Caching is
+ * enabled only if `core.untrackedCache` is true, since it relies on the
+ * modification time of a directory changing whenever an entry is added to or
+ * removed from it (which Git can test using `git update-index
+ * --test-untracked-cache`).
+ *
+ * What was found in a directory is considered valid if its modification time,
+ * that of its ignore file, and the names of the tracked entries in it are
+ * unchanged (and the same is true for all its ancestors' ignore files). The
+ * exclude file and the global ignore file must also be unchanged.
+ *
+ * @param repo Git repository.
+ */
+UntrackedCache::UntrackedCache(C::git_repository* repo) : repo(repo), enabled(false), directories_read(0)
+{
+    char const* workdir = C::git_repository_workdir(repo);
+    C::git_config* config;
+    if (workdir == nullptr || C::git_repository_config_snapshot(&config, repo) != 0)
+    {
+        return;
+    }
+    int untracked_cache;
+    this->enabled = C::git_config_get_bool(&untracked_cache, config, "core.untrackedCache") == 0 && untracked_cache;
+    std::filesystem::path excludes_file;
+    char const* excludes_file_config;
+    char const* home = std::getenv("HOME");
+    char const* config_home = std::getenv("XDG_CONFIG_HOME");
+    if (C::git_config_get_string(&excludes_file_config, config, "core.excludesFile") == 0)
+    {
+        std::string_view excludes_file_view(excludes_file_config);
+        excludes_file = excludes_file_view.rfind("~/", 0) == 0 && home != nullptr
+            ? std::filesystem::path(home) / excludes_file_view.substr(2)
+            : std::filesystem::path(excludes_file_view);
+    }
+    else if (config_home != nullptr && config_home[0] != '\0')
+    {
+        excludes_file = std::filesystem::path(config_home) / "git/ignore";
+    }
+    else if (home != nullptr)
+    {
+        excludes_file = std::filesystem::path(home) / ".config/git/ignore";
+    }
+    C::git_config_free(config);
+    this->workdir = workdir;
+    if (!this->enabled)
+    {
+        return;
+    }
+    std::filesystem::path gitdir = C::git_repository_path(repo);
+    std::filesystem::path commondir = C::git_repository_commondir(repo);
+    std::ostringstream fingerprint_stream;
+    fingerprint_stream << gitdir.string() << ' ' << modification_time(commondir / "info/exclude") << ' '
+                       << modification_time(excludes_file) << ' ' << excludes_file.string();
+    this->fingerprint = fingerprint_stream.str();
+    this->path = cache_file_path("untracked", gitdir.string());
+}
+
+/**
+ * Check whether what is found is remembered for the next prompt.
+ *
+ * @return Whether caching is enabled.
+ */
+bool UntrackedCache::is_enabled(void) const
+{
+    return this->enabled;
+}
+
+/**
+ * Count the untracked files. As with libgit2, an untracked directory counts
+ * as one file (if it contains anything not ignored), and its contents are not
+ * counted individually. If caching is not enabled, every directory is read.
+ *
+ * @param index_file Index of the repository.
+ * @param counts Counts to update. The untracked directories are also noted.
+ *
+ * @return Whether the untracked files were counted.
+ */
+bool UntrackedCache::count(IndexFile const& index_file, StatusCounts& counts)
+{
+    TraceSpan trace_span(__func__);
+    if (this->workdir.empty())
+    {
+        return false;
+    }
+
+    // Digest the names of the tracked entries in every directory containing
+    // tracked files (directly or not).
+    this->tracked_digests[""] = 0;
+    for (std::string_view const& entry_path : index_file.paths)
+    {
+        if (!this->tracked_files.insert(entry_path).second)
+        {
+            continue;
+        }
+        // Each directory's name is added to its parent's digest only once.
+        for (std::string_view child = entry_path;;)
+        {
+            std::size_t pos = child.rfind('/');
+            std::string_view directory = pos == std::string_view::npos ? std::string_view() : child.substr(0, pos);
+            auto [it, inserted] = this->tracked_digests.try_emplace(directory, 0);
+            it->second += hash_name(child.substr(pos == std::string_view::npos ? 0 : pos + 1));
+            if (!inserted)
+            {
+                break;
+            }
+            child = directory;
+        }
+    }
+
+    this->load();
+    this->visit("", true, false, counts);
+    LOG_DEBUG(
+        logger, "Counted untracked files", "untracked", counts.untracked, "directories", this->current.size(), "read",
+        this->directories_read
+    );
+    if (this->directories_read > 0 || this->current.size() != this->previous.size())
+    {
+        this->store();
+    }
+    // These refer to the index.
+    this->tracked_files.clear();
+    this->tracked_digests.clear();
+    return true;
+}
+
+/**
+ * Read what was found in each directory the previous time, if it is valid.
+ */
+void UntrackedCache::load(void)
+{
+    if (this->path.empty())
+    {
+        return;
+    }
+    std::ifstream cache_file(this->path);
+    std::string magic, fingerprint;
+    if (!std::getline(cache_file, magic) || magic != UNTRACKED_CACHE_MAGIC || !std::getline(cache_file, fingerprint)
+        || fingerprint != this->fingerprint)
+    {
+        LOG_DEBUG(logger, "No valid untracked cache", "path", this->path.string());
+        return;
+    }
+    UntrackedDirectory record;
+    char tracked;
+    std::size_t entrycount;
+    std::string directory;
+    while (cache_file >> record.mtime >> record.ignore_mtime >> record.tracked_digest >> tracked >> record.partial
+           >> entrycount
+           && cache_file.get() == ' ' && std::getline(cache_file, directory))
+    {
+        record.tracked = tracked == 't';
+        record.entries.resize(entrycount);
+        for (auto& [kind, name] : record.entries)
+        {
+            if (!cache_file.get(kind) || !std::getline(cache_file, name))
+            {
+                this->previous.clear();
+                return;
+            }
+        }
+        this->previous[directory] = record;
+    }
+    if (!cache_file.eof())
+    {
+        this->previous.clear();
+    }
+}
+
+/**
+ * Remember what was found in each directory for the next prompt.
+ */
+void UntrackedCache::store(void) const
+{
+    if (this->path.empty())
+    {
+        return;
+    }
+    std::ostringstream cache_stream;
+    cache_stream << UNTRACKED_CACHE_MAGIC << '\n' << this->fingerprint << '\n';
+    for (auto const& [directory, record] : this->current)
+    {
+        if (directory.find('\n') != std::string::npos)
+        {
+            continue;
+        }
+        std::ostringstream record_stream;
+        record_stream << record.mtime << ' ' << record.ignore_mtime << ' ' << record.tracked_digest << ' '
+                      << (record.tracked ? 't' : 'u') << ' ' << record.partial << ' ' << record.entries.size() << ' '
+                      << directory << '\n';
+        bool storable = true;
+        for (auto const& [kind, name] : record.entries)
+        {
+            if (name.find('\n') != std::string::npos)
+            {
+                // Cannot be remembered. Make sure this directory is read next
+                // time.
+                storable = false;
+                break;
+            }
+            record_stream << kind << name << '\n';
+        }
+        if (storable)
+        {
+            cache_stream << record_stream.str();
+        }
+    }
+    replace_file_contents(this->path, cache_stream.str());
+}
+
+/**
+ * Find the untracked files in a directory and its subdirectories, reading
+ * only those which changed.
+ *
+ * @param directory Directory, relative to the working tree.
+ * @param tracked Whether the directory contains tracked files. If it does, its
+ * untracked entries are counted. If it does not, it is itself untracked, and
+ * only needs to be checked for being non-empty.
+ * @param rules_changed Whether an ignore file of an ancestor directory changed.
+ * @param counts Counts to update.
+ *
+ * @return Whether an untracked directory is non-empty.
+ */
+bool UntrackedCache::visit(std::string const& directory, bool tracked, bool rules_changed, StatusCounts& counts)
+{
+    // Obtain the modification times before reading the directory, so that
+    // changes made while reading it are noticed the next time.
+    std::filesystem::path directory_path = this->workdir / directory;
+    std::int64_t mtime = modification_time(directory_path);
+    std::int64_t ignore_mtime = modification_time(directory_path / ".gitignore");
+    auto tracked_digests_it = this->tracked_digests.find(directory);
+    std::uint64_t tracked_digest = tracked_digests_it == this->tracked_digests.end() ? 0 : tracked_digests_it->second;
+    auto previous_it = this->previous.find(directory);
+    if (previous_it != this->previous.end())
+    {
+        UntrackedDirectory record = previous_it->second;
+        rules_changed = rules_changed || record.ignore_mtime != ignore_mtime;
+        if (!rules_changed && record.mtime == mtime && record.tracked_digest == tracked_digest
+            && record.tracked == tracked)
+        {
+            // An untracked directory is remembered only up to the first entry
+            // which showed that it is non-empty. If that entry no longer does,
+            // the rest must be read.
+            bool nonempty = this->tally(directory, tracked, rules_changed, record, counts);
+            if (nonempty || tracked || !record.partial)
+            {
+                this->current[directory] = std::move(record);
+                return nonempty;
+            }
+        }
+    }
+    else
+    {
+        // The ignore files of subdirectories may have changed without anyone
+        // noticing.
+        rules_changed = true;
+    }
+
+    UntrackedDirectory record = { mtime, ignore_mtime, tracked_digest, tracked, false, {} };
+    this->read_directory(directory, tracked, record);
+    ++this->directories_read;
+    bool nonempty = this->tally(directory, tracked, rules_changed, record, counts);
+    this->current[directory] = std::move(record);
+    return nonempty;
+}
+
+/**
+ * Count the untracked entries of a directory, visiting its subdirectories.
+ *
+ * @param directory Directory, relative to the working tree.
+ * @param tracked Whether the directory contains tracked files.
+ * @param rules_changed Whether an ignore file of this directory or an
+ * ancestor directory changed.
+ * @param record What was found in the directory. For an untracked directory,
+ * the entries after the first which shows that it is non-empty are dropped.
+ * @param counts Counts to update.
+ *
+ * @return Whether an untracked directory is non-empty.
+ */
+bool UntrackedCache::tally(
+    std::string const& directory, bool tracked, bool rules_changed, UntrackedDirectory& record, StatusCounts& counts
+)
+{
+    for (auto it = record.entries.begin(); it != record.entries.end(); ++it)
+    {
+        auto const& [kind, name] = *it;
+        std::string entry_path = child_path(directory, name);
+        bool untracked = kind == NESTED_REPOSITORY || kind == UNTRACKED_FILE;
+        if (kind == SUBDIRECTORY)
+        {
+            bool tracked_subdirectory = this->tracked_digests.count(entry_path) > 0;
+            untracked = this->visit(entry_path, tracked_subdirectory, rules_changed, counts);
+            if (untracked && tracked)
+            {
+                counts.untracked_directories.push_back(entry_path);
+            }
+        }
+        if (!untracked)
+        {
+            continue;
+        }
+        if (!tracked)
+        {
+            record.partial = record.partial || it + 1 != record.entries.end();
+            record.entries.erase(it + 1, record.entries.end());
+            return true;
+        }
+        if (counts.untracked <= counts.limits.untracked)
+        {
+            LOG_DEBUG(logger, "Found file in repository", "path", entry_path, "status", "untracked");
+            ++counts.untracked;
+        }
+    }
+    return false;
+}
+
+/**
+ * Read a directory, noting the entries which are untracked and not ignored,
+ * and the subdirectories which are not ignored. Reading an untracked
+ * directory stops at the first entry which shows that it is non-empty.
+ *
+ * @param directory Directory, relative to the working tree.
+ * @param tracked Whether the directory contains tracked files.
+ * @param record What was found in the directory, to fill in.
+ */
+void UntrackedCache::read_directory(std::string const& directory, bool tracked, UntrackedDirectory& record) const
+{
+    std::error_code ec;
+    for (auto const& entry : std::filesystem::directory_iterator(this->workdir / directory, ec))
+    {
+        std::string name = entry.path().filename().string();
+        if (name == ".git")
+        {
+            // Another repository, which counts as untracked unless it is a
+            // submodule (in which case this directory would be tracked).
+            if (!tracked)
+            {
+                record.entries = { { NESTED_REPOSITORY, name } };
+                record.partial = true;
+                return;
+            }
+            continue;
+        }
+        std::string entry_path = child_path(directory, name);
+        if (this->tracked_files.count(entry_path) > 0)
+        {
+            continue;
+        }
+        bool is_directory = entry.is_directory(ec) && !entry.is_symlink(ec);
+        if (is_directory && this->tracked_digests.count(entry_path) > 0)
+        {
+            record.entries.emplace_back(SUBDIRECTORY, std::move(name));
+            continue;
+        }
+        if (this->is_ignored(is_directory ? entry_path + '/' : entry_path))
+        {
+            continue;
+        }
+        if (is_directory)
+        {
+            record.entries.emplace_back(SUBDIRECTORY, std::move(name));
+            continue;
+        }
+        if (!tracked)
+        {
+            record.entries = { { UNTRACKED_FILE, std::move(name) } };
+            record.partial = true;
+            return;
+        }
+        record.entries.emplace_back(UNTRACKED_FILE, std::move(name));
+    }
+}
+
+/**
+ * Check whether a path is ignored.
+ *
+ * @param entry_path Path, relative to the working tree. Directories must end
+ * with a slash.
+ *
+ * @return Whether the path is ignored.
+ */
+bool UntrackedCache::is_ignored(std::string const& entry_path) const
+{
+    int ignored;
+    return C::git_ignore_path_is_ignored(&ignored, this->repo, entry_path.data()) == 0 && ignored;
+}
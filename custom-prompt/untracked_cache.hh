@@ -0,0 +1,62 @@
+#ifndef UNTRACKED_CACHE_HH_
+#define UNTRACKED_CACHE_HH_
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "git_status.hh"
+#include "index_file.hh"
+#include "libgit2.hh"
+
+/**
+ * What was found in a directory of the working tree the last time it was
+ * read.
+ */
+struct UntrackedDirectory
+{
+    std::int64_t mtime, ignore_mtime;
+    std::uint64_t tracked_digest;
+    bool tracked, partial;
+    std::vector<std::pair<char, std::string>> entries;
+};
+
+/**
+ * Count the untracked files in a Git repository without libgit2 comparing the
+ * tracked files too. If enabled, what was found in each directory is
+ * remembered across prompts (in the spirit of Git's untracked cache), so that
+ * only directories which changed need to be read and matched against the
+ * ignore rules.
+ */
+class UntrackedCache
+{
+private:
+    C::git_repository* repo;
+    bool enabled;
+    std::filesystem::path path, workdir;
+    std::string fingerprint;
+    std::unordered_set<std::string_view> tracked_files;
+    std::unordered_map<std::string_view, std::uint64_t> tracked_digests;
+    std::unordered_map<std::string, UntrackedDirectory> previous, current;
+    unsigned directories_read;
+
+public:
+    UntrackedCache(C::git_repository*);
+    bool is_enabled(void) const;
+    bool count(IndexFile const&, StatusCounts&);
+
+private:
+    void load(void);
+    void store(void) const;
+    bool visit(std::string const&, bool, bool, StatusCounts&);
+    bool tally(std::string const&, bool, bool, UntrackedDirectory&, StatusCounts&);
+    void read_directory(std::string const&, bool, UntrackedDirectory&) const;
+    bool is_ignored(std::string const&) const;
+};
+
+#endif